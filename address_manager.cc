@@ -0,0 +1,309 @@
+#include "address_manager.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ns3
+{
+
+AddressManager::AddressManager(uint32_t seed)
+    : m_tried_count(0),
+      m_group_bits(16),
+      m_new_bucket_count(MIN_NEW_BUCKET_COUNT),
+      m_tried_bucket_count(MIN_TRIED_BUCKET_COUNT),
+      m_buckets_per_source_group(MIN_NEW_BUCKET_COUNT / SOURCE_GROUP_SHARE)
+{
+    SetSeed(seed);
+}
+
+void
+AddressManager::SetSeed(uint32_t seed)
+{
+    m_key = Mix32(seed, 0x9e3779b9);
+    m_rng.seed(seed);
+    Rebucket();
+}
+
+void
+AddressManager::Configure(int group_bits, size_t expected_size)
+{
+    m_group_bits = std::max(1, std::min(group_bits, 32));
+
+    // Twice the slots of the addresses expected in the new table, half in the tried one
+    int expected = static_cast<int>(std::min<size_t>(expected_size, 1 << 24));
+    int new_buckets = (2 * expected + BUCKET_SIZE - 1) / BUCKET_SIZE;
+    int tried_buckets = (expected / 2 + BUCKET_SIZE - 1) / BUCKET_SIZE;
+    m_new_bucket_count = new_buckets > MIN_NEW_BUCKET_COUNT ? new_buckets : MIN_NEW_BUCKET_COUNT;
+    m_tried_bucket_count =
+        tried_buckets > MIN_TRIED_BUCKET_COUNT ? tried_buckets : MIN_TRIED_BUCKET_COUNT;
+    m_buckets_per_source_group = m_new_bucket_count / SOURCE_GROUP_SHARE;
+    Rebucket();
+}
+
+void
+AddressManager::Rebucket()
+{
+    // Known addresses move to their slots under the current key and sizes, losing any
+    // collision
+    std::vector<Entry> entries;
+    entries.swap(m_entries);
+    m_index.clear();
+    m_new.assign(m_new_bucket_count, std::vector<int>());
+    m_tried.assign(m_tried_bucket_count, std::vector<int>());
+    m_tried_count = 0;
+
+    for (const Entry& entry : entries)
+    {
+        if (!Add(entry.address, entry.source))
+        {
+            continue;
+        }
+        if (entry.tried)
+        {
+            Good(entry.address);
+        }
+        m_entries[m_index[entry.address.Get()]].attempts = entry.attempts;
+    }
+}
+
+// Addresses in the same group are assumed to be run by the same operator
+uint32_t
+AddressManager::Group(Ipv4Address address) const
+{
+    return static_cast<uint32_t>(uint64_t(address.Get()) >> (32 - m_group_bits));
+}
+
+int
+AddressManager::NewBucket(Ipv4Address address, Ipv4Address source) const
+{
+    // A source group reaches m_buckets_per_source_group buckets, whatever it sends
+    uint32_t source_group = Group(source);
+    uint32_t spread = Mix32(Group(address), m_key ^ source_group) % m_buckets_per_source_group;
+    return Mix32(source_group, m_key + spread) % m_new_bucket_count;
+}
+
+int
+AddressManager::TriedBucket(Ipv4Address address) const
+{
+    return Mix32(address.Get(), m_key) % m_tried_bucket_count;
+}
+
+int
+AddressManager::Slot(Ipv4Address address, bool tried, int bucket) const
+{
+    return Mix32(address.Get(), m_key ^ (bucket * 2 + tried)) % BUCKET_SIZE;
+}
+
+int&
+AddressManager::SlotAt(bool tried, int bucket, int slot)
+{
+    std::vector<int>& slots = (tried ? m_tried : m_new)[bucket];
+    if (slots.empty())
+    {
+        slots.assign(BUCKET_SIZE, -1);
+    }
+    return slots[slot];
+}
+
+void
+AddressManager::Place(int index, bool tried)
+{
+    Entry& entry = m_entries[index];
+    entry.tried = tried;
+    entry.bucket = tried ? TriedBucket(entry.address) : NewBucket(entry.address, entry.source);
+    entry.slot = Slot(entry.address, tried, entry.bucket);
+    SlotAt(tried, entry.bucket, entry.slot) = index;
+    m_tried_count += tried;
+}
+
+bool
+AddressManager::Add(Ipv4Address address, Ipv4Address source)
+{
+    if (Contains(address))
+    {
+        return false;
+    }
+
+    int bucket = NewBucket(address, source);
+    int occupant = SlotAt(false, bucket, Slot(address, false, bucket));
+    if (occupant >= 0)
+    {
+        if (m_entries[occupant].attempts < MAX_FAILED_ATTEMPTS)
+        {
+            return false;
+        }
+        Remove(occupant);
+    }
+
+    int index = static_cast<int>(m_entries.size());
+    m_entries.push_back(Entry{address, source, false, 0, 0, 0});
+    m_index[address.Get()] = index;
+    Place(index, false);
+    return true;
+}
+
+void
+AddressManager::Good(Ipv4Address address)
+{
+    auto it = m_index.find(address.Get());
+    if (it == m_index.end())
+    {
+        return;
+    }
+
+    int index = it->second;
+    m_entries[index].attempts = 0;
+    if (m_entries[index].tried)
+    {
+        return;
+    }
+
+    SlotAt(false, m_entries[index].bucket, m_entries[index].slot) = -1;
+
+    // The tried address in the way goes back to the new table, evicting whatever holds
+    // its slot there
+    int bucket = TriedBucket(address);
+    int displaced = SlotAt(true, bucket, Slot(address, true, bucket));
+    if (displaced >= 0)
+    {
+        m_tried_count--;
+        Entry& entry = m_entries[displaced];
+        int new_bucket = NewBucket(entry.address, entry.source);
+        int occupant = SlotAt(false, new_bucket, Slot(entry.address, false, new_bucket));
+        if (occupant >= 0)
+        {
+            Remove(occupant);
+            // Removal moves the last entry into the freed index
+            if (displaced == static_cast<int>(m_entries.size()))
+            {
+                displaced = occupant;
+            }
+            if (index == static_cast<int>(m_entries.size()))
+            {
+                index = occupant;
+            }
+        }
+        Place(displaced, false);
+    }
+
+    Place(index, true);
+}
+
+void
+AddressManager::Attempt(Ipv4Address address)
+{
+    auto it = m_index.find(address.Get());
+    if (it != m_index.end())
+    {
+        m_entries[it->second].attempts++;
+    }
+}
+
+bool
+AddressManager::Select(Ipv4Address& address)
+{
+    if (m_entries.empty())
+    {
+        return false;
+    }
+
+    int new_count = static_cast<int>(m_entries.size()) - m_tried_count;
+    bool tried = m_tried_count > 0 && (new_count == 0 || m_rng() % 2 == 0);
+    Table& table = tried ? m_tried : m_new;
+
+    // Each failure makes an address less likely, the bar drops with every rejection so
+    // the search always ends
+    std::uniform_real_distribution<double> uniform(0, 1);
+    double chance_factor = 1.0;
+    while (true)
+    {
+        const std::vector<int>& slots = table[m_rng() % table.size()];
+        if (slots.empty())
+        {
+            continue;
+        }
+        int index = slots[m_rng() % BUCKET_SIZE];
+        if (index < 0)
+        {
+            continue;
+        }
+
+        double chance = std::pow(0.66, std::min(m_entries[index].attempts, 8));
+        if (uniform(m_rng) < chance * chance_factor)
+        {
+            address = m_entries[index].address;
+            return true;
+        }
+        chance_factor *= 1.2;
+    }
+}
+
+std::vector<Ipv4Address>
+AddressManager::Sample(size_t max_count)
+{
+    std::vector<Ipv4Address> sample;
+    size_t count = std::min(max_count, m_entries.size());
+    sample.reserve(count);
+
+    // Partial Fisher-Yates over the entries themselves
+    for (size_t i = 0; i < m_entries.size() && sample.size() < count; i++)
+    {
+        size_t j = i + m_rng() % (m_entries.size() - i);
+        SwapEntries(static_cast<int>(i), static_cast<int>(j));
+        if (m_entries[i].attempts < MAX_FAILED_ATTEMPTS)
+        {
+            sample.push_back(m_entries[i].address);
+        }
+    }
+    return sample;
+}
+
+std::vector<Ipv4Address>
+AddressManager::GetAddresses() const
+{
+    std::vector<Ipv4Address> addresses;
+    addresses.reserve(m_entries.size());
+    for (const Entry& entry : m_entries)
+    {
+        addresses.push_back(entry.address);
+    }
+    return addresses;
+}
+
+void
+AddressManager::Remove(int index)
+{
+    Entry& entry = m_entries[index];
+    SlotAt(entry.tried, entry.bucket, entry.slot) = -1;
+    m_tried_count -= entry.tried;
+
+    int last = static_cast<int>(m_entries.size()) - 1;
+    SwapEntries(index, last);
+    m_index.erase(m_entries[last].address.Get());
+    m_entries.pop_back();
+}
+
+void
+AddressManager::SwapEntries(int a, int b)
+{
+    if (a == b)
+    {
+        return;
+    }
+
+    std::swap(m_entries[a], m_entries[b]);
+    for (int index : {a, b})
+    {
+        Entry& entry = m_entries[index];
+        m_index[entry.address.Get()] = index;
+        int& slot = SlotAt(entry.tried, entry.bucket, entry.slot);
+        if (slot == a || slot == b)
+        {
+            slot = index;
+        }
+    }
+}
+
+} // namespace ns3
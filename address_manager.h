@@ -0,0 +1,102 @@
+#pragma once
+
+#include "ns3/ipv4-address.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace ns3
+{
+// Known peer addresses, bucketed as in Bitcoin's addrman. Addresses heard of go into the
+// new table, in a bucket picked by a keyed hash of their group (the /16 by default) and
+// that of the peer that sent them, so one source can only fill an eighth of the buckets.
+// Addresses connected to move to the tried table. A slot taken by an address that still
+// works is not given up to a newcomer. Entries are kept dense so sampling is a partial
+// shuffle.
+class AddressManager
+{
+  public:
+    explicit AddressManager(uint32_t seed = 0);
+
+    // Reseeds both the bucket key and the sampling; known addresses are rebucketed
+    void SetSeed(uint32_t seed);
+
+    // Addresses sharing their first group_bits bits count as one operator's, and the
+    // tables get room for about expected_size addresses. Known addresses are rebucketed.
+    void Configure(int group_bits, size_t expected_size);
+
+    // False if the address is already known or its slot is held by a good address
+    bool Add(Ipv4Address address, Ipv4Address source);
+
+    // A connection to the address succeeded: it moves to the tried table
+    void Good(Ipv4Address address);
+
+    // A connection to the address is being attempted
+    void Attempt(Ipv4Address address);
+
+    bool Contains(Ipv4Address address) const
+    {
+        return m_index.find(address.Get()) != m_index.end();
+    }
+
+    // Picks a random address to connect to, tried and new alike, favoring those that
+    // have not failed. False if nothing is known.
+    bool Select(Ipv4Address& address);
+
+    // Up to max_count random addresses, without the ones that keep failing
+    std::vector<Ipv4Address> Sample(size_t max_count);
+
+    std::vector<Ipv4Address> GetAddresses() const;
+
+    size_t GetSize() const
+    {
+        return m_entries.size();
+    }
+
+  private:
+    static const int MIN_NEW_BUCKET_COUNT = 64;
+    static const int MIN_TRIED_BUCKET_COUNT = 16;
+    static const int BUCKET_SIZE = 32;
+    static const int SOURCE_GROUP_SHARE = 8; // a source group reaches 1/8 of new buckets
+    static const int MAX_FAILED_ATTEMPTS = 3;
+
+    struct Entry
+    {
+        Ipv4Address address;
+        Ipv4Address source;
+        bool tried;
+        int bucket;
+        int slot;
+        int attempts; // failed or pending since the last success
+    };
+
+    // Buckets are allocated on first use, slots hold entry indexes or -1
+    typedef std::vector<std::vector<int>> Table;
+
+    uint32_t Group(Ipv4Address address) const;
+    int NewBucket(Ipv4Address address, Ipv4Address source) const;
+    int TriedBucket(Ipv4Address address) const;
+    int Slot(Ipv4Address address, bool tried, int bucket) const;
+    int& SlotAt(bool tried, int bucket, int slot);
+    void Place(int index, bool tried);
+    void Remove(int index);
+    void SwapEntries(int a, int b);
+    void Rebucket();
+
+    std::vector<Entry> m_entries;
+    std::unordered_map<uint32_t, int> m_index;
+    Table m_new;
+    Table m_tried;
+    int m_tried_count;
+    int m_group_bits;
+    int m_new_bucket_count;
+    int m_tried_bucket_count;
+    int m_buckets_per_source_group;
+    uint32_t m_key;
+    std::mt19937 m_rng;
+};
+
+} // namespace ns3
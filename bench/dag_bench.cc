@@ -0,0 +1,359 @@
+// Standalone microbenchmark for the Blockchain/GHOSTDAG engine.
+//
+// It lives outside the scratch directory so ns-3 doesn't link its main() into the
+// simulation. Only ns-3's Ipv4Address is needed, e.g.:
+//
+//   g++ -std=c++17 -O2 -pthread -I<ns-3 include dir> -I.. dag_bench.cc ../dag.cc
+//       ../reachability.cc ../block_set.cc ../kcluster_audit.cc -lns3-network -lns3-core
+//
+// Blocks are mined as a Poisson process at --rate blocks/s and each becomes visible
+// after a uniform delay in [0, --delay] s, so rate * delay sets the DAG width. A new
+// block takes up to --parents of the visible tips, newest first.
+
+#include "kcluster_audit.h"
+
+#include "dag.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+struct BenchConfig
+{
+    int blocks = 20000;
+    double rate = 1.0;
+    double delay = 5.0;
+    int max_parents = 10;
+    int k = 18;
+    int pruning_depth = 0;
+    int queries = 200;
+    unsigned seed = 1;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double
+ElapsedSeconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool
+ParseOption(const char* arg, const char* name, std::string& value)
+{
+    size_t name_length = std::strlen(name);
+    if (std::strncmp(arg, name, name_length) != 0 || arg[name_length] != '=')
+    {
+        return false;
+    }
+    value = arg + name_length + 1;
+    return true;
+}
+
+bool
+ParseArgs(int argc, char* argv[], BenchConfig& config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (ParseOption(argv[i], "--blocks", value))
+        {
+            config.blocks = std::atoi(value.c_str());
+        }
+        else if (ParseOption(argv[i], "--rate", value))
+        {
+            config.rate = std::atof(value.c_str());
+        }
+        else if (ParseOption(argv[i], "--delay", value))
+        {
+            config.delay = std::atof(value.c_str());
+        }
+        else if (ParseOption(argv[i], "--parents", value))
+        {
+            config.max_parents = std::atoi(value.c_str());
+        }
+        else if (ParseOption(argv[i], "--k", value))
+        {
+            config.k = std::atoi(value.c_str());
+        }
+        else if (ParseOption(argv[i], "--pruning-depth", value))
+        {
+            config.pruning_depth = std::atoi(value.c_str());
+        }
+        else if (ParseOption(argv[i], "--queries", value))
+        {
+            config.queries = std::atoi(value.c_str());
+        }
+        else if (ParseOption(argv[i], "--seed", value))
+        {
+            config.seed = static_cast<unsigned>(std::atoi(value.c_str()));
+        }
+        else
+        {
+            std::fprintf(stderr,
+                         "usage: %s [--blocks=N] [--rate=blocks/s] [--delay=s] [--parents=N] "
+                         "[--k=N] [--pruning-depth=N] [--queries=N] [--seed=N]\n",
+                         argv[0]);
+            return false;
+        }
+    }
+    return config.blocks > 1 && config.rate > 0 && config.max_parents > 0 && config.k >= 0;
+}
+
+// Blocks in creation order, each with parents among the tips visible when it was mined
+std::vector<Block>
+GenerateDag(const BenchConfig& config, int genesis_id)
+{
+    std::mt19937 rng(config.seed);
+    std::exponential_distribution<double> interval(config.rate);
+    std::uniform_real_distribution<double> delay(0.0, config.delay);
+
+    struct Pending
+    {
+        int block_id;
+        double visible_at;
+        bool parents_covered;
+    };
+
+    std::vector<Block> dag;
+    dag.reserve(config.blocks);
+
+    // Blocks without a visible child yet, oldest first; covered is indexed by id - genesis
+    std::vector<Pending> uncovered{{genesis_id, 0.0, true}};
+    std::vector<char> covered(config.blocks + 1, false);
+    double now = 0;
+
+    for (int i = 0; i < config.blocks; i++)
+    {
+        now += interval(rng);
+
+        // A block that became visible covers its parents for every later block
+        for (Pending& pending : uncovered)
+        {
+            if (!pending.parents_covered && pending.visible_at <= now)
+            {
+                for (int parent_id : dag[pending.block_id - genesis_id - 1].header.parent_hashes)
+                {
+                    covered[parent_id - genesis_id] = true;
+                }
+                pending.parents_covered = true;
+            }
+        }
+        uncovered.erase(std::remove_if(uncovered.begin(),
+                                       uncovered.end(),
+                                       [&](const Pending& pending) {
+                                           return covered[pending.block_id - genesis_id];
+                                       }),
+                        uncovered.end());
+
+        Block block;
+        block.header.block_id = genesis_id + 1 + i;
+        block.header.miner_id = static_cast<int>(rng() % 100);
+        block.header.time_created = now;
+        block.time_received = now;
+
+        for (auto it = uncovered.rbegin(); it != uncovered.rend(); ++it)
+        {
+            if (it->visible_at <= now)
+            {
+                block.header.parent_hashes.push_back(it->block_id);
+                if (static_cast<int>(block.header.parent_hashes.size()) == config.max_parents)
+                {
+                    break;
+                }
+            }
+        }
+
+        uncovered.push_back({block.header.block_id, now + delay(rng), false});
+        dag.push_back(block);
+    }
+
+    return dag;
+}
+
+long
+PeakMemoryKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void
+ReportLatencies(const char* name, std::vector<double>& seconds)
+{
+    if (seconds.empty())
+    {
+        return;
+    }
+
+    std::sort(seconds.begin(), seconds.end());
+    double total = 0;
+    for (double s : seconds)
+    {
+        total += s;
+    }
+
+    auto percentile = [&seconds](double p) {
+        size_t index = static_cast<size_t>(p * (seconds.size() - 1));
+        return seconds[index] * 1e6;
+    };
+
+    std::printf("%-26s %9zu ops %12.0f ops/s  p50 %9.2fus  p99 %9.2fus  max %9.2fus\n",
+                name,
+                seconds.size(),
+                seconds.size() / total,
+                percentile(0.5),
+                percentile(0.99),
+                seconds.back() * 1e6);
+}
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    BenchConfig config;
+    if (!ParseArgs(argc, argv, config))
+    {
+        return 1;
+    }
+
+    Blockchain blockchain(config.k, config.pruning_depth);
+    std::vector<Block> dag = GenerateDag(config, blockchain.pruning_point);
+    blockchain.next_block_id += config.blocks;
+
+    std::printf("blocks %d rate %.2f/s delay %.2fs parents <= %d k %d pruning depth %d\n",
+                config.blocks,
+                config.rate,
+                config.delay,
+                config.max_parents,
+                config.k,
+                config.pruning_depth);
+
+    std::vector<double> add_latencies;
+    add_latencies.reserve(dag.size());
+    uint64_t first_half_relabels = 0;
+    Clock::time_point build_start = Clock::now();
+    for (const Block& block : dag)
+    {
+        if (add_latencies.size() == dag.size() / 2)
+        {
+            first_half_relabels = blockchain.reachability.reindexed_blocks;
+        }
+        Clock::time_point start = Clock::now();
+        blockchain.AddBlock(block);
+        add_latencies.push_back(ElapsedSeconds(start));
+    }
+    double build_seconds = ElapsedSeconds(build_start);
+
+    std::printf("built in %.3fs, %d stored, width %d, red %d, reindexes %d\n",
+                build_seconds,
+                blockchain.blocks.GetCount(),
+                blockchain.GetDagWidth(),
+                static_cast<int>(std::count_if(blockchain.ordering.begin(),
+                                               blockchain.ordering.end(),
+                                               [&](int id) { return blockchain.IsRed(id); })),
+                blockchain.reachability.reindex_count);
+    ReportLatencies("AddBlock", add_latencies);
+
+    // Reindexing is amortized, so the second half of the blocks shouldn't relabel much more
+    // per block than the first; quadratic growth makes it about three times as much
+    size_t first_half = dag.size() / 2;
+    double first_half_rate = double(first_half_relabels) / first_half;
+    double second_half_rate =
+        double(blockchain.reachability.reindexed_blocks - first_half_relabels) /
+        (dag.size() - first_half);
+    bool reindex_flat = second_half_rate <= 2 * std::max(first_half_rate, 1.0);
+    std::printf("reindex relabels per block: first half %.2f, second half %.2f%s\n",
+                first_half_rate,
+                second_half_rate,
+                reindex_flat ? "" : " (growing)");
+
+    std::mt19937 rng(config.seed + 1);
+    auto random_block = [&]() {
+        int first = blockchain.blocks.GetFirstId();
+        int span = blockchain.blocks.GetIdBound() - first;
+        int block_id;
+        do
+        {
+            block_id = first + static_cast<int>(rng() % span);
+        } while (!blockchain.HasBlock(block_id));
+        return block_id;
+    };
+
+    std::vector<double> latencies;
+    for (int i = 0; i < config.queries; i++)
+    {
+        int block_id = random_block();
+        Clock::time_point start = Clock::now();
+        std::set<int> past = blockchain.GetPast(block_id);
+        latencies.push_back(ElapsedSeconds(start));
+    }
+    ReportLatencies("GetPast", latencies);
+
+    latencies.clear();
+    for (int i = 0; i < config.queries; i++)
+    {
+        int block_id = random_block();
+        int other_block_id = random_block();
+        Clock::time_point start = Clock::now();
+        std::set<int> anticone = blockchain.GetAnticone(block_id, other_block_id);
+        latencies.push_back(ElapsedSeconds(start));
+    }
+    ReportLatencies("GetAnticone", latencies);
+
+    latencies.clear();
+    for (int i = 0; i < config.queries; i++)
+    {
+        int block_id = random_block();
+        int other_block_id = random_block();
+        Clock::time_point start = Clock::now();
+        volatile bool in_anticone = blockchain.IsInAnticone(block_id, other_block_id);
+        (void)in_anticone;
+        latencies.push_back(ElapsedSeconds(start));
+    }
+    ReportLatencies("IsInAnticone", latencies);
+
+    latencies.clear();
+    for (int i = 0; i < config.queries * 100; i++)
+    {
+        Clock::time_point start = Clock::now();
+        volatile int tip = blockchain.SelectTip();
+        (void)tip;
+        latencies.push_back(ElapsedSeconds(start));
+    }
+    ReportLatencies("SelectTip", latencies);
+
+    latencies.clear();
+    for (int i = 0; i < std::max(1, config.queries / 10); i++)
+    {
+        Clock::time_point start = Clock::now();
+        std::vector<int> ordering = blockchain.ComputeGHOSTDAGOrdering();
+        latencies.push_back(ElapsedSeconds(start));
+    }
+    ReportLatencies("ComputeGHOSTDAGOrdering", latencies);
+
+    Clock::time_point audit_start = Clock::now();
+    KClusterAuditResult audit = AuditKCluster(blockchain);
+    std::printf("k-cluster audit %d blocks, %zu violations in %.3fs\n",
+                audit.audited_blocks,
+                audit.violating_blocks.size(),
+                ElapsedSeconds(audit_start));
+
+    std::printf("peak memory %ld KB\n", PeakMemoryKb());
+
+    if (!audit.Passed())
+    {
+        return 2;
+    }
+    return reindex_flat ? 0 : 3;
+}
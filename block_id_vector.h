@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+
+// Vector indexed directly by block id over a sliding window [first id, id bound), so that
+// per-block arrays can release the ids left behind by pruning.
+template <typename T>
+struct BlockIdVector
+{
+    BlockIdVector()
+        : first_id(0)
+    {
+    }
+
+    int first_id;
+    std::vector<T> values;
+
+    T& operator[](int block_id)
+    {
+        return values[block_id - first_id];
+    }
+
+    const T& operator[](int block_id) const
+    {
+        return values[block_id - first_id];
+    }
+
+    bool InWindow(int block_id) const
+    {
+        return block_id >= first_id && block_id < GetIdBound();
+    }
+
+    int GetFirstId() const
+    {
+        return first_id;
+    }
+
+    int GetIdBound() const
+    {
+        return first_id + static_cast<int>(values.size());
+    }
+
+    // Make every id below id_bound addressable, filling new slots with value
+    void EnsureBound(int id_bound, const T& value = T())
+    {
+        if (id_bound > GetIdBound())
+        {
+            values.resize(id_bound - first_id, value);
+        }
+    }
+
+    // Release every id below block_id
+    void DropBelow(int block_id)
+    {
+        if (block_id <= first_id)
+        {
+            return;
+        }
+
+        if (block_id >= GetIdBound())
+        {
+            values.clear();
+            values.shrink_to_fit();
+        }
+        else
+        {
+            values.erase(values.begin(), values.begin() + (block_id - first_id));
+        }
+        first_id = block_id;
+    }
+};
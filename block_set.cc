@@ -0,0 +1,224 @@
+#include "block_set.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#if defined(__AVX2__)
+// Nibble lookup popcount (Mula), returning four 64-bit partial sums
+inline __m256i
+Popcount256(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i counts =
+        _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+inline int
+HorizontalSum(__m256i v)
+{
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+    return static_cast<int>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+#endif
+
+int
+PopcountAnd(const uint64_t* a, const uint64_t* b, size_t n)
+{
+    size_t i = 0;
+    int count = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        acc = _mm256_add_epi64(acc, Popcount256(_mm256_and_si256(va, vb)));
+    }
+    count = HorizontalSum(acc);
+#endif
+    for (; i < n; i++)
+    {
+        count += __builtin_popcountll(a[i] & b[i]);
+    }
+    return count;
+}
+
+// Words of a and b that cover the same ids
+struct Overlap
+{
+    size_t a_offset;
+    size_t b_offset;
+    size_t count;
+};
+
+Overlap
+GetOverlap(const BlockSet& a, const BlockSet& b)
+{
+    long start = std::max(a.base, b.base);
+    long end = std::min(a.base + 64 * static_cast<long>(a.words.size()),
+                        b.base + 64 * static_cast<long>(b.words.size()));
+    if (end <= start)
+    {
+        return Overlap{0, 0, 0};
+    }
+    return Overlap{static_cast<size_t>((start - a.base) / 64),
+                   static_cast<size_t>((start - b.base) / 64),
+                   static_cast<size_t>((end - start) / 64)};
+}
+} // namespace
+
+int
+BlockSet::Count() const
+{
+    size_t i = 0;
+    int count = 0;
+    const uint64_t* data = words.data();
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 4 <= words.size(); i += 4)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        acc = _mm256_add_epi64(acc, Popcount256(v));
+    }
+    count = HorizontalSum(acc);
+#endif
+    for (; i < words.size(); i++)
+    {
+        count += __builtin_popcountll(data[i]);
+    }
+    return count;
+}
+
+bool
+BlockSet::Empty() const
+{
+    return std::all_of(words.begin(), words.end(), [](uint64_t word) { return word == 0; });
+}
+
+void
+BlockSet::Rebase(int new_base)
+{
+    words.insert(words.begin(), (base - new_base) / 64, 0);
+    base = new_base;
+}
+
+void
+BlockSet::UnionWith(const BlockSet& other)
+{
+    if (other.words.empty())
+    {
+        return;
+    }
+    if (other.base < base)
+    {
+        Rebase(other.base);
+    }
+    size_t offset = (other.base - base) / 64;
+    if (words.size() < offset + other.words.size())
+    {
+        words.resize(offset + other.words.size(), 0);
+    }
+
+    size_t n = other.words.size();
+    size_t i = 0;
+    uint64_t* dst = words.data() + offset;
+    const uint64_t* src = other.words.data();
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(va, vb));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        dst[i] |= src[i];
+    }
+}
+
+void
+BlockSet::IntersectWith(const BlockSet& other)
+{
+    // Words outside the other set's range end up empty
+    Overlap overlap = GetOverlap(*this, other);
+    words.resize(overlap.a_offset + overlap.count);
+    std::fill(words.begin(), words.begin() + overlap.a_offset, 0);
+
+    size_t n = overlap.count;
+    size_t i = 0;
+    uint64_t* dst = words.data() + overlap.a_offset;
+    const uint64_t* src = other.words.data() + overlap.b_offset;
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_and_si256(va, vb));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        dst[i] &= src[i];
+    }
+}
+
+void
+BlockSet::Subtract(const BlockSet& other)
+{
+    Overlap overlap = GetOverlap(*this, other);
+    size_t n = overlap.count;
+    size_t i = 0;
+    uint64_t* dst = words.data() + overlap.a_offset;
+    const uint64_t* src = other.words.data() + overlap.b_offset;
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        // andnot computes ~first & second
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_andnot_si256(vb, va));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        dst[i] &= ~src[i];
+    }
+}
+
+int
+BlockSet::IntersectionCount(const BlockSet& other) const
+{
+    Overlap overlap = GetOverlap(*this, other);
+    return PopcountAnd(words.data() + overlap.a_offset,
+                       other.words.data() + overlap.b_offset,
+                       overlap.count);
+}
+
+std::vector<int>
+BlockSet::ToVector() const
+{
+    std::vector<int> ids;
+    ids.reserve(Count());
+    ForEach([&ids](int block_id) { ids.push_back(block_id); });
+    return ids;
+}
+
+std::set<int>
+BlockSet::ToSet() const
+{
+    std::set<int> ids;
+    ForEach([&ids](int block_id) { ids.insert(ids.end(), block_id); });
+    return ids;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+// Dense bitset over block ids. Set algebra and popcounts run over whole 64-bit words and
+// use AVX2 kernels when the build enables them.
+struct BlockSet
+{
+    std::vector<uint64_t> words;
+    int base; // id of the first bit, a multiple of 64
+
+    BlockSet()
+        : base(0)
+    {
+    }
+
+    explicit BlockSet(int id_bound)
+        : words((id_bound + 63) / 64, 0),
+          base(0)
+    {
+    }
+
+    // Sized for ids in [first_id, id_bound), e.g. the blocks stored since the last prune
+    BlockSet(int first_id, int id_bound)
+        : base(first_id / 64 * 64)
+    {
+        words.assign(id_bound > base ? (id_bound - base + 63) / 64 : 0, 0);
+    }
+
+    void Insert(int block_id)
+    {
+        // An empty set starts at the first id inserted
+        if (words.empty())
+        {
+            base = block_id / 64 * 64;
+        }
+        else if (block_id < base)
+        {
+            Rebase(block_id / 64 * 64);
+        }
+        size_t word = static_cast<size_t>(block_id - base) / 64;
+        if (word >= words.size())
+        {
+            words.resize(word + 1, 0);
+        }
+        words[word] |= uint64_t(1) << (block_id % 64);
+    }
+
+    void Erase(int block_id)
+    {
+        if (block_id < base)
+        {
+            return;
+        }
+        size_t word = static_cast<size_t>(block_id - base) / 64;
+        if (word < words.size())
+        {
+            words[word] &= ~(uint64_t(1) << (block_id % 64));
+        }
+    }
+
+    bool Contains(int block_id) const
+    {
+        if (block_id < base)
+        {
+            return false;
+        }
+        size_t word = static_cast<size_t>(block_id - base) / 64;
+        return word < words.size() && (words[word] >> (block_id % 64)) & 1;
+    }
+
+    template <typename F>
+    void ForEach(F&& f) const
+    {
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            uint64_t word = words[i];
+            while (word)
+            {
+                f(base + static_cast<int>(i * 64 + __builtin_ctzll(word)));
+                word &= word - 1;
+            }
+        }
+    }
+
+    int Count() const;
+    bool Empty() const;
+
+    void UnionWith(const BlockSet& other);
+    void IntersectWith(const BlockSet& other);
+    void Subtract(const BlockSet& other);
+
+    // |this & other| without materializing the intersection
+    int IntersectionCount(const BlockSet& other) const;
+
+    std::vector<int> ToVector() const;
+    std::set<int> ToSet() const;
+
+  private:
+    // Moves the first bit down to new_base, which must be a lower multiple of 64
+    void Rebase(int new_base);
+};
@@ -1,80 +1,211 @@
 #include "dag.h"
 
+#include <algorithm>
 #include <queue>
+#include <unordered_set>
 
 void
 Blockchain::AddBlock(const Block& block)
 {
-    bool is_orphan = false;
+    if (HasBlock(block.header.block_id) || orphans.Has(block.header.block_id))
+    {
+        return;
+    }
+
+    // Ids below the stored window were pruned, so such blocks can never be connected
+    if (block.header.block_id < blocks.GetFirstId())
+    {
+        return;
+    }
+
+    std::vector<int> missing_parents;
     for (int parent_id : block.header.parent_hashes)
     {
-        if (blocks.find(parent_id) == blocks.end())
+        if (parent_id < blocks.GetFirstId())
         {
-            is_orphan = true;
-            break;
+            return;
+        }
+        if (!blocks.Has(parent_id))
+        {
+            missing_parents.push_back(parent_id);
         }
     }
 
-    if (is_orphan)
+    if (!missing_parents.empty())
     {
-        orphans[block.header.block_id] = block;
+        orphans.Add(block, missing_parents);
         return;
     }
 
-    blocks[block.header.block_id] = block;
-
-    for (int parent_id : block.header.parent_hashes)
+    if (!ConnectBlock(block))
     {
-        children[parent_id].insert(block.header.block_id);
+        return;
     }
 
-    for (int parent_id : block.header.parent_hashes)
+    // Unorphan iteratively so long chains of orphans can't overflow the stack
+    std::vector<Block> ready;
+    orphans.ReleaseChildren(block.header.block_id, ready);
+    while (!ready.empty())
     {
-        tips.erase(parent_id);
+        Block orphan_block = std::move(ready.back());
+        ready.pop_back();
+        if (ConnectBlock(orphan_block))
+        {
+            orphans.ReleaseChildren(orphan_block.header.block_id, ready);
+        }
     }
-    tips.insert(block.header.block_id);
 
-    std::set<int> blue_set = CalculateBlueSet(block.header.block_id);
-    blocks[block.header.block_id].is_blue =
-        (blue_set.find(block.header.block_id) != blue_set.end());
-    blocks[block.header.block_id].blue_score = CalculateBlueScore(block.header.block_id, blue_set);
-    int max_blue_parent = -1;
-    int max_blue_score = -1;
+    AdvancePruningPoint();
+    UpdateVirtual();
+}
+
+bool
+Blockchain::ConnectBlock(const Block& block)
+{
+    // An orphan may be released after pruning removed one of its other parents
     for (int parent_id : block.header.parent_hashes)
     {
-        if (blocks[parent_id].blue_score > max_blue_score)
+        if (!blocks.Has(parent_id))
         {
-            max_blue_score = blocks[parent_id].blue_score;
-            max_blue_parent = parent_id;
+            return false;
         }
     }
-    blocks[block.header.block_id].selected_parent = max_blue_parent;
 
-    // Unorphan if needs
-    std::vector<int> to_unorphan;
-    for (auto& orphan_pair : orphans)
+    // A selected chain that doesn't run through the pruning point would merge pruned data
+    int selected_parent = FindSelectedParent(block.header.parent_hashes);
+    if (selected_parent != -1 &&
+        !reachability.IsReachabilityTreeAncestorOf(pruning_point, selected_parent))
     {
-        bool can_add = true;
-        for (int parent_id : orphan_pair.second.header.parent_hashes)
-        {
-            if (blocks.find(parent_id) == blocks.end())
-            {
-                can_add = false;
-                break;
-            }
-        }
-        if (can_add)
-        {
-            to_unorphan.push_back(orphan_pair.first);
-        }
+        return false;
+    }
+
+    int block_id = block.header.block_id;
+    blocks.Add(block);
+
+    GhostdagData data = ComputeGhostdag(block.header.parent_hashes);
+
+    reachability.AddBlock(block_id, data.selected_parent, SortedMergeset(data));
+
+    // Blocks are blue in their own view until the selected chain merges them
+    blocks.is_blue[block_id] = true;
+    blocks.blue_score[block_id] = data.blue_score;
+    blocks.selected_parent[block_id] = data.selected_parent;
+    ghostdag_data.EnsureBound(block_id + 1);
+    chain_positions.EnsureBound(block_id + 1, -1);
+    ordering_positions.EnsureBound(block_id + 1, -1);
+    ghostdag_data[block_id] = std::move(data);
+
+    // The tip heap orders by blue score, so tips change once it is known
+    for (int parent_id : block.header.parent_hashes)
+    {
+        RemoveTip(parent_id);
+    }
+    AddTip(block_id);
+
+    // Only the new block can displace the selected tip
+    if (IsPreferredTip(block_id, GetSelectedTip()))
+    {
+        UpdateSelectedChain(block_id);
+    }
+
+    return true;
+}
+
+void
+Blockchain::UpdateSelectedChain(int new_selected_tip)
+{
+    // Walk down from the new tip until meeting the current chain
+    std::vector<int> new_chain_blocks;
+    int current = new_selected_tip;
+    while (current != -1 && !IsOnSelectedChain(current))
+    {
+        new_chain_blocks.push_back(current);
+        current = blocks.selected_parent[current];
+    }
+
+    if (current == -1)
+    {
+        return;
+    }
+
+    // Roll back the chain blocks and ordering above the fork point
+    int fork_index = chain_positions[current] - chain_offset;
+    for (int i = static_cast<int>(selected_chain.size()) - 1; i > fork_index; i--)
+    {
+        chain_positions[selected_chain[i]] = -1;
+    }
+
+    int keep_ordered = (fork_index + 1 < static_cast<int>(selected_chain.size()))
+                           ? chain_ordering_starts[fork_index + 1] - ordering_offset
+                           : static_cast<int>(ordering.size());
+    for (int i = keep_ordered; i < static_cast<int>(ordering.size()); i++)
+    {
+        ordering_positions[ordering[i]] = -1;
+    }
+    ordering.resize(keep_ordered);
+    selected_chain.resize(fork_index + 1);
+    chain_ordering_starts.resize(fork_index + 1);
+
+    for (auto it = new_chain_blocks.rbegin(); it != new_chain_blocks.rend(); ++it)
+    {
+        AppendChainBlock(*it);
+    }
+}
+
+void
+Blockchain::AppendChainBlock(int chain_block)
+{
+    const GhostdagData& data = ghostdag_data[chain_block];
+
+    chain_positions[chain_block] = chain_offset + static_cast<int>(selected_chain.size());
+    selected_chain.push_back(chain_block);
+    chain_ordering_starts.push_back(ordering_offset + static_cast<int>(ordering.size()));
+
+    for (int merged_id : SortedMergeset(data))
+    {
+        ordering_positions[merged_id] = ordering_offset + static_cast<int>(ordering.size());
+        ordering.push_back(merged_id);
+    }
+    ordering_positions[chain_block] = ordering_offset + static_cast<int>(ordering.size());
+    ordering.push_back(chain_block);
+
+    // Colours follow the view of the selected chain
+    for (int blue_id : data.mergeset_blues)
+    {
+        blocks.is_blue[blue_id] = true;
+    }
+    for (int red_id : data.mergeset_reds)
+    {
+        blocks.is_blue[red_id] = false;
     }
+}
 
-    for (int orphan_id : to_unorphan)
+std::vector<int>
+Blockchain::SortedMergeset(const GhostdagData& data) const
+{
+    std::vector<int> mergeset;
+    if (!data.mergeset_blues.empty())
     {
-        Block orphan_block = orphans[orphan_id];
-        orphans.erase(orphan_id);
-        AddBlock(orphan_block);
+        mergeset.assign(data.mergeset_blues.begin() + 1, data.mergeset_blues.end());
     }
+    mergeset.insert(mergeset.end(), data.mergeset_reds.begin(), data.mergeset_reds.end());
+
+    SortByBlueScore(mergeset);
+
+    return mergeset;
+}
+
+void
+Blockchain::SortByBlueScore(std::vector<int>& block_ids) const
+{
+    const BlockIdVector<int>& blue_scores = blocks.blue_score;
+    std::sort(block_ids.begin(), block_ids.end(), [&blue_scores](int a, int b) {
+        if (blue_scores[a] != blue_scores[b])
+        {
+            return blue_scores[a] < blue_scores[b];
+        }
+        return a < b;
+    });
 }
 
 std::set<int>
@@ -87,144 +218,211 @@ std::set<int>
 Blockchain::GreedyBlueSet(int block_id)
 {
     std::set<int> blue;
-    std::set<int> past = GetPast(block_id);
 
-    if (past.empty())
+    if (!blocks.Has(block_id))
     {
-        blue.insert(block_id);
         return blue;
     }
 
-    int max_blue_parent = -1;
-    int max_blue_score = -1;
+    // The blue set of a block is itself plus the mergeset blues along its selected chain
+    blue.insert(block_id);
+    int chain_block = block_id;
+    while (chain_block != -1)
+    {
+        const GhostdagData& data = ghostdag_data[chain_block];
+        blue.insert(data.mergeset_blues.begin(), data.mergeset_blues.end());
+        chain_block = data.selected_parent;
+    }
 
-    for (int parent_id : blocks[block_id].header.parent_hashes)
+    return blue;
+}
+
+GhostdagData
+Blockchain::ComputeGhostdag(const std::vector<int>& parents)
+{
+    GhostdagData data;
+
+    int selected_parent = FindSelectedParent(parents);
+    if (selected_parent == -1)
     {
-        if (blocks[parent_id].blue_score > max_blue_score)
-        {
-            max_blue_score = blocks[parent_id].blue_score;
-            max_blue_parent = parent_id;
-        }
+        data.blue_score = 1;
+        return data;
     }
 
-    if (max_blue_parent != -1)
+    data.selected_parent = selected_parent;
+    data.mergeset_blues.push_back(selected_parent);
+    data.blues_anticone_sizes[selected_parent] = 0;
+
+    // Ancestors always have a strictly lower blue score, so this is also a topological order
+    std::vector<int> mergeset = ComputeMergeset(selected_parent, parents);
+    SortByBlueScore(mergeset);
+
+    for (int candidate : mergeset)
     {
-        std::set<int> parent_past = GetPast(max_blue_parent);
-        for (int bid : parent_past)
+        std::unordered_map<int, int> candidate_blues_anticone_sizes;
+        int candidate_anticone_size = 0;
+
+        if (CheckBlueCandidate(data,
+                               candidate,
+                               candidate_blues_anticone_sizes,
+                               candidate_anticone_size))
         {
-            if (blocks[bid].is_blue)
+            data.mergeset_blues.push_back(candidate);
+            data.blues_anticone_sizes[candidate] = candidate_anticone_size;
+            for (const auto& [blue_id, size] : candidate_blues_anticone_sizes)
             {
-                blue.insert(bid);
+                data.blues_anticone_sizes[blue_id] = size + 1;
             }
         }
-        if (blocks[max_blue_parent].is_blue)
+        else
         {
-            blue.insert(max_blue_parent);
+            data.mergeset_reds.push_back(candidate);
         }
     }
 
-    for (int bid : past)
+    data.blue_score =
+        blocks.blue_score[selected_parent] + static_cast<int>(data.mergeset_blues.size());
+
+    return data;
+}
+
+int
+Blockchain::FindSelectedParent(const std::vector<int>& parents)
+{
+    int selected_parent = -1;
+    int max_blue_score = -1;
+
+    for (int parent_id : parents)
     {
-        if (blue.find(bid) == blue.end())
+        int score = blocks.blue_score[parent_id];
+        // Use block_id as tie-breaker for determinism, same as SelectTip
+        if (score > max_blue_score || (score == max_blue_score && parent_id < selected_parent))
         {
-            std::set<int> test_blue = blue;
-            test_blue.insert(bid);
+            max_blue_score = score;
+            selected_parent = parent_id;
+        }
+    }
 
-            int anticone_size = 0;
-            for (auto it1 = test_blue.begin(); it1 != test_blue.end(); ++it1)
-            {
-                auto it2 = it1;
-                ++it2;
-                for (; it2 != test_blue.end(); ++it2)
-                {
-                    std::set<int> anticone = GetAnticone(*it1, *it2);
-                    for (int ac : anticone)
-                    {
-                        if (test_blue.find(ac) != test_blue.end())
-                        {
-                            anticone_size++;
-                            if (anticone_size > ghostdag_k)
-                            {
-                                break;
-                            }
-                        }
-                    }
-                    if (anticone_size > ghostdag_k)
-                    {
-                        break;
-                    }
-                }
-                if (anticone_size > ghostdag_k)
-                {
-                    break;
-                }
-            }
+    return selected_parent;
+}
 
-            if (anticone_size <= ghostdag_k)
-            {
-                blue.insert(bid);
-            }
+std::vector<int>
+Blockchain::ComputeMergeset(int selected_parent, const std::vector<int>& parents)
+{
+    std::vector<int> mergeset;
+    std::unordered_set<int> visited;
+    std::queue<int> to_visit;
+
+    visited.insert(selected_parent);
+    for (int parent_id : parents)
+    {
+        if (visited.insert(parent_id).second && !IsDagAncestorOf(parent_id, selected_parent))
+        {
+            to_visit.push(parent_id);
         }
     }
 
-    // Check if block_id itself can be added to blue set
-    int current_anticone_size = 0;
-    for (auto it1 = blue.begin(); it1 != blue.end(); ++it1)
+    // Walk back from the other parents until reaching the past of the selected parent
+    while (!to_visit.empty())
     {
-        auto it2 = it1;
-        ++it2;
-        for (; it2 != blue.end(); ++it2)
+        int current = to_visit.front();
+        to_visit.pop();
+        mergeset.push_back(current);
+
+        for (int parent_id : blocks.GetParents(current))
         {
-            std::set<int> anticone = GetAnticone(*it1, *it2);
-            for (int ac : anticone)
+            if (!visited.insert(parent_id).second)
             {
-                if (blue.find(ac) != blue.end() || ac == block_id)
-                {
-                    current_anticone_size++;
-                    if (current_anticone_size > ghostdag_k)
-                    {
-                        break;
-                    }
-                }
+                continue;
             }
-            if (current_anticone_size > ghostdag_k)
+            if (IsDagAncestorOf(parent_id, selected_parent))
             {
-                break;
+                continue;
             }
+            to_visit.push(parent_id);
         }
-        if (current_anticone_size > ghostdag_k)
+    }
+
+    return mergeset;
+}
+
+bool
+Blockchain::CheckBlueCandidate(const GhostdagData& new_block_data,
+                               int candidate,
+                               std::unordered_map<int, int>& candidate_blues_anticone_sizes,
+                               int& candidate_anticone_size)
+{
+    // The selected parent plus at most k other blues fit in a mergeset
+    if (static_cast<int>(new_block_data.mergeset_blues.size()) == ghostdag_k + 1)
+    {
+        return false;
+    }
+
+    const GhostdagData* chain_data = &new_block_data;
+    int chain_block = -1;
+
+    while (chain_data)
+    {
+        // Everything merged below a chain block in the candidate's past is in its past too
+        if (chain_block != -1 && IsDagAncestorOf(chain_block, candidate))
         {
             break;
         }
-    }
 
-    // Also check anticone between block_id and blue blocks
-    for (int blue_block : blue)
-    {
-        std::set<int> anticone = GetAnticone(block_id, blue_block);
-        for (int ac : anticone)
+        for (int blue_id : chain_data->mergeset_blues)
         {
-            if (blue.find(ac) != blue.end())
+            if (IsDagAncestorOf(blue_id, candidate))
             {
-                current_anticone_size++;
-                if (current_anticone_size > ghostdag_k)
-                {
-                    break;
-                }
+                continue;
+            }
+
+            int blue_anticone_size = BlueAnticoneSize(blue_id, new_block_data);
+            candidate_blues_anticone_sizes[blue_id] = blue_anticone_size;
+            candidate_anticone_size++;
+
+            if (candidate_anticone_size > ghostdag_k || blue_anticone_size == ghostdag_k)
+            {
+                return false;
             }
         }
-        if (current_anticone_size > ghostdag_k)
-        {
-            break;
-        }
+
+        chain_block = chain_data->selected_parent;
+        chain_data = (chain_block == -1) ? nullptr : &ghostdag_data[chain_block];
     }
 
-    if (current_anticone_size <= ghostdag_k)
+    return true;
+}
+
+int
+Blockchain::BlueAnticoneSize(int block_id, const GhostdagData& context) const
+{
+    const GhostdagData* current = &context;
+
+    while (current)
     {
-        blue.insert(block_id);
+        auto it = current->blues_anticone_sizes.find(block_id);
+        if (it != current->blues_anticone_sizes.end())
+        {
+            return it->second;
+        }
+        current =
+            (current->selected_parent == -1) ? nullptr : &ghostdag_data[current->selected_parent];
     }
 
-    return blue;
+    return 0;
+}
+
+bool
+Blockchain::IsDagAncestorOf(int ancestor_id, int descendant_id) const
+{
+    return reachability.IsDagAncestorOf(ancestor_id, descendant_id);
+}
+
+bool
+Blockchain::IsInAnticone(int block_id, int other_block_id) const
+{
+    return block_id != other_block_id && !reachability.IsDagAncestorOf(block_id, other_block_id) &&
+           !reachability.IsDagAncestorOf(other_block_id, block_id);
 }
 
 int
@@ -252,39 +450,54 @@ Blockchain::CalculateBlueScore(int block_id, const std::set<int>& blue_set)
 std::set<int>
 Blockchain::GetPast(int block_id)
 {
-    std::set<int> past;
-    std::queue<int> to_visit;
+    return GetPastSet(block_id).ToSet();
+}
+
+std::set<int>
+Blockchain::GetFuture(int block_id)
+{
+    return GetFutureSet(block_id).ToSet();
+}
+
+std::set<int>
+Blockchain::GetAnticone(int block_id, int other_block_id)
+{
+    return GetAnticoneSet(block_id, other_block_id).ToSet();
+}
+
+BlockSet
+Blockchain::GetPastSet(int block_id) const
+{
+    BlockSet past(blocks.GetFirstId(), blocks.GetIdBound());
+    std::vector<int> to_visit;
 
-    if (blocks.find(block_id) == blocks.end())
+    if (!blocks.Has(block_id))
     {
         return past;
     }
 
-    for (int parent_id : blocks[block_id].header.parent_hashes)
+    for (int parent_id : blocks.GetParents(block_id))
     {
-        to_visit.push(parent_id);
+        to_visit.push_back(parent_id);
     }
 
     while (!to_visit.empty())
     {
-        int current = to_visit.front();
-        to_visit.pop();
+        int current = to_visit.back();
+        to_visit.pop_back();
 
-        if (past.find(current) != past.end())
+        if (past.Contains(current))
         {
             continue;
         }
 
-        past.insert(current);
+        past.Insert(current);
 
-        if (blocks.find(current) != blocks.end())
+        for (int parent_id : blocks.GetParents(current))
         {
-            for (int parent_id : blocks[current].header.parent_hashes)
+            if (!past.Contains(parent_id))
             {
-                if (past.find(parent_id) == past.end())
-                {
-                    to_visit.push(parent_id);
-                }
+                to_visit.push_back(parent_id);
             }
         }
     }
@@ -292,40 +505,39 @@ Blockchain::GetPast(int block_id)
     return past;
 }
 
-std::set<int>
-Blockchain::GetFuture(int block_id)
+BlockSet
+Blockchain::GetFutureSet(int block_id) const
 {
-    std::set<int> future;
-    std::queue<int> to_visit;
+    BlockSet future(blocks.GetFirstId(), blocks.GetIdBound());
+    std::vector<int> to_visit;
 
-    if (children.find(block_id) != children.end())
+    if (!blocks.Has(block_id))
     {
-        for (int child_id : children[block_id])
-        {
-            to_visit.push(child_id);
-        }
+        return future;
+    }
+
+    for (int child_id : blocks.GetChildren(block_id))
+    {
+        to_visit.push_back(child_id);
     }
 
     while (!to_visit.empty())
     {
-        int current = to_visit.front();
-        to_visit.pop();
+        int current = to_visit.back();
+        to_visit.pop_back();
 
-        if (future.find(current) != future.end())
+        if (future.Contains(current))
         {
             continue;
         }
 
-        future.insert(current);
+        future.Insert(current);
 
-        if (children.find(current) != children.end())
+        for (int child_id : blocks.GetChildren(current))
         {
-            for (int child_id : children[current])
+            if (!future.Contains(child_id))
             {
-                if (future.find(child_id) == future.end())
-                {
-                    to_visit.push(child_id);
-                }
+                to_visit.push_back(child_id);
             }
         }
     }
@@ -333,157 +545,268 @@ Blockchain::GetFuture(int block_id)
     return future;
 }
 
-std::set<int>
-Blockchain::GetAnticone(int block_id, int other_block_id)
+BlockSet
+Blockchain::GetAnticoneSet(int block_id, int other_block_id) const
 {
-    std::set<int> anticone;
-
-    std::set<int> past_1 = GetPast(block_id);
-    std::set<int> future_1 = GetFuture(block_id);
-
-    if (past_1.find(other_block_id) != past_1.end() ||
-        future_1.find(other_block_id) != future_1.end())
+    if (IsDagAncestorOf(block_id, other_block_id) || IsDagAncestorOf(other_block_id, block_id))
     {
-        return anticone; // Empty set
+        return BlockSet(); // Empty set
     }
 
-    std::set<int> past_2 = GetPast(other_block_id);
-    std::set<int> future_2 = GetFuture(other_block_id);
-
-    for (const auto& pair : blocks)
-    {
-        int bid = pair.first;
-        if (bid == block_id || bid == other_block_id)
-        {
-            continue;
-        }
+    // Blocks in the anticone of both: everything minus the past and future of either
+    BlockSet anticone = GetAllBlocksSet();
+    anticone.Subtract(GetPastSet(block_id));
+    anticone.Subtract(GetFutureSet(block_id));
+    anticone.Subtract(GetPastSet(other_block_id));
+    anticone.Subtract(GetFutureSet(other_block_id));
+    anticone.Erase(block_id);
+    anticone.Erase(other_block_id);
 
-        bool in_past_or_future_1 =
-            (past_1.find(bid) != past_1.end()) || (future_1.find(bid) != future_1.end());
-        bool in_past_or_future_2 =
-            (past_2.find(bid) != past_2.end()) || (future_2.find(bid) != future_2.end());
+    return anticone;
+}
 
-        if (!in_past_or_future_1 && !in_past_or_future_2)
+BlockSet
+Blockchain::GetAllBlocksSet() const
+{
+    BlockSet all(blocks.GetFirstId(), blocks.GetIdBound());
+    for (int bid = blocks.GetFirstId(); bid < blocks.GetIdBound(); bid++)
+    {
+        if (blocks.present[bid])
         {
-            anticone.insert(bid);
+            all.Insert(bid);
         }
     }
-
-    return anticone;
+    return all;
 }
 
 int
-Blockchain::SelectTip()
+Blockchain::SelectTip() const
 {
     if (tips.empty())
     {
         return -1;
     }
+    return tips.front();
+}
 
-    int max_blue_score = -1;
-    int selected_tip = -1;
-
-    for (int tip : tips)
+bool
+Blockchain::IsPreferredTip(int block_id, int other_block_id) const
+{
+    if (blocks.blue_score[block_id] != blocks.blue_score[other_block_id])
     {
-        if (blocks[tip].blue_score > max_blue_score)
-        {
-            max_blue_score = blocks[tip].blue_score;
-            selected_tip = tip;
-        }
-        else if (blocks[tip].blue_score == max_blue_score && selected_tip != -1)
-        {
-            // Use block_id as tie-breaker for determinism
-            if (tip < selected_tip)
-            {
-                selected_tip = tip;
-            }
-        }
+        return blocks.blue_score[block_id] > blocks.blue_score[other_block_id];
     }
-
-    return selected_tip;
+    // Use block_id as tie-breaker for determinism
+    return block_id < other_block_id;
 }
 
 std::vector<int>
 Blockchain::ComputeGHOSTDAGOrdering()
 {
-    std::vector<int> ordering;
+    std::vector<int> result = ordering;
+
+    // Blocks outside the selected tip's past are ordered as the mergeset of the virtual
+    // block
+    std::vector<int> virtual_mergeset = SortedMergeset(virtual_data);
+    result.insert(result.end(), virtual_mergeset.begin(), virtual_mergeset.end());
+
+    return result;
+}
+
+void
+Blockchain::UpdateVirtual()
+{
+    // The virtual block merges every tip, so only its mergeset (the anticone of the
+    // selected tip) is coloured again
+    std::vector<int> virtual_parents(tips.begin(), tips.end());
+    virtual_data = ComputeGhostdag(virtual_parents);
+}
+
+void
+Blockchain::AdvancePruningPoint()
+{
+    if (pruning_depth <= 0)
+    {
+        return;
+    }
 
-    std::map<int, int> in_degree;
-    std::set<int> visited;
+    int tip_score = blocks.blue_score[GetSelectedTip()];
+    if (tip_score - blocks.blue_score[pruning_point] < 2 * pruning_depth)
+    {
+        return;
+    }
 
-    for (const auto& pair : blocks)
+    // The deepest chain block still at least pruning_depth below the selected tip
+    int chain_index = chain_positions[pruning_point] - chain_offset;
+    while (chain_index + 1 < static_cast<int>(selected_chain.size()) &&
+           tip_score - blocks.blue_score[selected_chain[chain_index + 1]] >= pruning_depth)
     {
-        in_degree[pair.first] = pair.second.header.parent_hashes.size();
+        chain_index++;
     }
 
-    auto cmp = [this](int a, int b) {
-        if (blocks[a].blue_score != blocks[b].blue_score)
-        {
-            return blocks[a].blue_score < blocks[b].blue_score;
-        }
-        if (blocks[a].header.time_created != blocks[b].header.time_created)
-        {
-            return blocks[a].header.time_created > blocks[b].header.time_created;
-        }
-        return a > b;
-    };
-    std::priority_queue<int, std::vector<int>, decltype(cmp)> pq(cmp);
+    PruneTo(selected_chain[chain_index]);
+}
 
-    for (const auto& pair : in_degree)
+void
+Blockchain::PruneTo(int new_pruning_point)
+{
+    // Keep the past of every tip that builds on the new pruning point, down to (and
+    // including) the pruning point itself; everything else can no longer be merged
+    BlockSet kept(blocks.GetFirstId(), blocks.GetIdBound());
+    std::vector<int> to_visit;
+    for (int tip : tips)
     {
-        if (pair.second == 0)
+        if (tip == new_pruning_point || IsDagAncestorOf(new_pruning_point, tip))
         {
-            pq.push(pair.first);
+            to_visit.push_back(tip);
         }
     }
 
-    while (!pq.empty())
+    while (!to_visit.empty())
     {
-        int current = pq.top();
-        pq.pop();
+        int current = to_visit.back();
+        to_visit.pop_back();
 
-        ordering.push_back(current);
-        visited.insert(current);
+        if (kept.Contains(current))
+        {
+            continue;
+        }
+        kept.Insert(current);
 
-        if (children.find(current) != children.end())
+        for (int parent_id : blocks.GetParents(current))
         {
-            for (int child : children[current])
+            if (!kept.Contains(parent_id) && !IsDagAncestorOf(parent_id, new_pruning_point))
             {
-                in_degree[child]--;
-                if (in_degree[child] == 0 && visited.find(child) == visited.end())
-                {
-                    pq.push(child);
-                }
+                to_visit.push_back(parent_id);
             }
         }
     }
 
-    return ordering;
-}
-
-bool
-Blockchain::IsKCluster(const std::set<int>& blue_set)
-{
-    for (int b1 : blue_set)
+    std::vector<int> pruned;
+    for (int bid = blocks.GetFirstId(); bid < blocks.GetIdBound(); bid++)
     {
-        for (int b2 : blue_set)
+        if (blocks.present[bid] && !kept.Contains(bid))
         {
-            if (b1 >= b2)
-            {
-                continue;
-            }
+            pruned.push_back(bid);
+        }
+    }
+
+    for (int bid : pruned)
+    {
+        RemoveTip(bid);
+        blocks.Remove(bid);
+        ghostdag_data[bid] = GhostdagData();
+        chain_positions[bid] = -1;
+        ordering_positions[bid] = -1;
+    }
+    reachability.Prune(pruned, new_pruning_point);
+    pruned_block_count += static_cast<long>(pruned.size());
+
+    // The pruning point becomes the genesis of what is left
+    blocks.DetachParents(new_pruning_point);
+    blocks.selected_parent[new_pruning_point] = -1;
+    GhostdagData& pruning_point_data = ghostdag_data[new_pruning_point];
+    pruning_point_data.selected_parent = -1;
+    pruning_point_data.mergeset_blues.clear();
+    pruning_point_data.mergeset_reds.clear();
+    pruning_point_data.blues_anticone_sizes.clear();
+
+    auto is_pruned = [this](int id) { return !blocks.Has(id); };
+    kept.ForEach([this, &is_pruned](int bid) {
+        blocks.DropMissingLinks(bid);
+
+        GhostdagData& data = ghostdag_data[bid];
+        if (data.selected_parent != -1 && is_pruned(data.selected_parent))
+        {
+            // Only kept anticone blocks can lose their selected parent; they are never
+            // walked as chain blocks again
+            data.selected_parent = -1;
+            data.mergeset_blues.clear();
+            data.mergeset_reds.clear();
+            data.blues_anticone_sizes.clear();
+            blocks.selected_parent[bid] = -1;
+            return;
+        }
+
+        data.mergeset_blues.erase(std::remove_if(data.mergeset_blues.begin(),
+                                                 data.mergeset_blues.end(),
+                                                 is_pruned),
+                                  data.mergeset_blues.end());
+        data.mergeset_reds.erase(
+            std::remove_if(data.mergeset_reds.begin(), data.mergeset_reds.end(), is_pruned),
+            data.mergeset_reds.end());
+        for (auto it = data.blues_anticone_sizes.begin(); it != data.blues_anticone_sizes.end();)
+        {
+            it = is_pruned(it->first) ? data.blues_anticone_sizes.erase(it) : std::next(it);
+        }
+    });
+
+    // Everything ordered before the pruning point was in its past
+    int chain_drop = chain_positions[new_pruning_point] - chain_offset;
+    selected_chain.erase(selected_chain.begin(), selected_chain.begin() + chain_drop);
+    chain_ordering_starts.erase(chain_ordering_starts.begin(),
+                                chain_ordering_starts.begin() + chain_drop);
+    chain_offset += chain_drop;
+    chain_ordering_starts[0] = ordering_positions[new_pruning_point];
+
+    int ordering_drop = ordering_positions[new_pruning_point] - ordering_offset;
+    ordering.erase(ordering.begin(), ordering.begin() + ordering_drop);
+    ordering_offset += ordering_drop;
+
+    pruning_point = new_pruning_point;
+
+    // Release the per-id storage below the oldest block left
+    std::vector<int> kept_ids = kept.ToVector();
+    int first_live_id = kept_ids.empty() ? new_pruning_point : kept_ids.front();
+    blocks.DropBelow(first_live_id);
+    ghostdag_data.DropBelow(first_live_id);
+    reachability.nodes.DropBelow(first_live_id);
+    tip_positions.DropBelow(first_live_id);
+    chain_positions.DropBelow(first_live_id);
+    ordering_positions.DropBelow(first_live_id);
+
+    // Orphans built on a pruned block could never be connected
+    BlockSet pruned_set;
+    for (int bid : pruned)
+    {
+        pruned_set.Insert(bid);
+    }
+    orphans.RemoveWithParent([first_live_id, &pruned_set](int parent_id) {
+        return parent_id < first_live_id || pruned_set.Contains(parent_id);
+    });
+}
 
-            std::set<int> anticone = GetAnticone(b1, b2);
-            int count = 0;
-            for (int bid : anticone)
+bool
+Blockchain::IsKCluster(const std::set<int>& blue_set)
+{
+    std::vector<int> blues(blue_set.begin(), blue_set.end());
+    int n = static_cast<int>(blues.size());
+
+    // Anticone of each blue restricted to the blue set, over indices into blues
+    std::vector<BlockSet> blue_anticones(n, BlockSet(n));
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = i + 1; j < n; j++)
+        {
+            if (IsInAnticone(blues[i], blues[j]))
             {
-                if (blue_set.find(bid) != blue_set.end())
-                {
-                    count++;
-                }
+                blue_anticones[i].Insert(j);
+                blue_anticones[j].Insert(i);
+            }
+        }
+    }
+
+    // Blues in the anticone of both members of an unrelated pair
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = i + 1; j < n; j++)
+        {
+            if (!blue_anticones[i].Contains(j))
+            {
+                continue;
             }
 
-            if (count > ghostdag_k)
+            if (blue_anticones[i].IntersectionCount(blue_anticones[j]) > ghostdag_k)
             {
                 return false;
             }
@@ -501,16 +824,15 @@ Blockchain::GetDagWidth() const
 bool
 Blockchain::HasBlock(int block_id) const
 {
-    return blocks.find(block_id) != blocks.end();
+    return blocks.Has(block_id);
 }
 
 bool
 Blockchain::IsRed(int block_id) const
 {
-    auto it = blocks.find(block_id);
-    if (it != blocks.end())
+    if (blocks.Has(block_id))
     {
-        return !it->second.is_blue;
+        return !blocks.is_blue[block_id];
     }
     return false;
 }
@@ -518,39 +840,623 @@ Blockchain::IsRed(int block_id) const
 bool
 Blockchain::IsOrphan(int block_id) const
 {
-    return orphans.find(block_id) != orphans.end();
+    return orphans.Has(block_id);
+}
+
+Block
+Blockchain::GetBlock(int block_id) const
+{
+    return blocks.GetBlock(block_id);
+}
+
+BlockHeader
+Blockchain::GetHeader(int block_id) const
+{
+    return blocks.GetHeader(block_id);
+}
+
+void
+Blockchain::AddHeader(const BlockHeader& header)
+{
+    Block block;
+    block.header = header;
+    block.has_body = false;
+    AddBlock(block);
+}
+
+void
+Blockchain::SetBody(const Block& body)
+{
+    int block_id = body.header.block_id;
+    if (!blocks.Has(block_id))
+    {
+        return;
+    }
+
+    // The body message only has the id, the rest of the header is already stored
+    Block full = blocks.GetBlock(block_id);
+    full.transactions = body.transactions;
+    full.size_in_bytes = body.size_in_bytes;
+    full.has_body = true;
+
+    BlockBody& stored = blocks.bodies[block_id];
+    stored.content = InternBlockContent(full);
+    stored.time_received = body.time_received;
+    stored.received_from = body.received_from;
+    stored.has_body = true;
+}
+
+std::vector<int>
+Blockchain::GetOrderedBlocksFrom(int start, int max_count) const
+{
+    std::vector<int> result;
+    for (int i = std::max(start - ordering_offset, 0);
+         i < static_cast<int>(ordering.size()) && static_cast<int>(result.size()) < max_count;
+         i++)
+    {
+        result.push_back(ordering[i]);
+    }
+
+    for (int block_id : SortedMergeset(virtual_data))
+    {
+        if (static_cast<int>(result.size()) >= max_count)
+        {
+            break;
+        }
+        result.push_back(block_id);
+    }
+    return result;
+}
+
+std::vector<int>
+Blockchain::GetChainLocator(int high, int low) const
+{
+    std::vector<int> locator;
+    int high_index = std::min(high - chain_offset, static_cast<int>(selected_chain.size()) - 1);
+    int low_index = std::max(low - chain_offset, 0);
+    if (high_index < low_index)
+    {
+        return locator;
+    }
+
+    int index = high_index;
+    int step = 1;
+    locator.push_back(selected_chain[index]);
+    while (index > low_index)
+    {
+        // Blue scores rise along the chain, so the next entry is found by binary search
+        int target = blocks.blue_score[selected_chain[index]] - step;
+        auto first = selected_chain.begin() + low_index;
+        auto last = selected_chain.begin() + index;
+        auto it = std::upper_bound(first, last, target, [this](int score, int block_id) {
+            return score < blocks.blue_score[block_id];
+        });
+        index = std::max(static_cast<int>(it - selected_chain.begin()) - 1, low_index);
+
+        locator.push_back(selected_chain[index]);
+        step *= 2;
+    }
+    return locator;
+}
+
+std::vector<int>
+Blockchain::GetAntipast(const std::vector<int>& known) const
+{
+    std::vector<int> roots;
+    for (int block_id : known)
+    {
+        if (blocks.Has(block_id))
+        {
+            roots.push_back(block_id);
+        }
+    }
+
+    // The antipast is closed under children, so walking down from the tips and stopping
+    // at known blocks and their past visits nothing else
+    auto is_known = [&](int block_id) {
+        for (int root : roots)
+        {
+            if (root == block_id || IsDagAncestorOf(block_id, root))
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::vector<int> result;
+    std::unordered_set<int> visited;
+    std::vector<int> stack;
+    for (int tip : tips)
+    {
+        if (visited.insert(tip).second && !is_known(tip))
+        {
+            stack.push_back(tip);
+        }
+    }
+
+    while (!stack.empty())
+    {
+        int block_id = stack.back();
+        stack.pop_back();
+        result.push_back(block_id);
+
+        for (int parent_id : blocks.GetParents(block_id))
+        {
+            if (blocks.Has(parent_id) && visited.insert(parent_id).second && !is_known(parent_id))
+            {
+                stack.push_back(parent_id);
+            }
+        }
+    }
+
+    SortByBlueScore(result);
+    return result;
+}
+
+BlockIdRange
+Blockchain::GetChildren(int block_id) const
+{
+    return blocks.GetChildren(block_id);
+}
+
+BlockIdRange
+Blockchain::GetParents(int block_id) const
+{
+    return blocks.GetParents(block_id);
+}
+
+void
+Blockchain::AddTip(int block_id)
+{
+    tip_positions.EnsureBound(block_id + 1, -1);
+    if (tip_positions[block_id] != -1)
+    {
+        return;
+    }
+    tip_positions[block_id] = static_cast<int>(tips.size());
+    tips.push_back(block_id);
+    SiftTipUp(static_cast<int>(tips.size()) - 1);
+}
+
+void
+Blockchain::RemoveTip(int block_id)
+{
+    if (!tip_positions.InWindow(block_id) || tip_positions[block_id] == -1)
+    {
+        return;
+    }
+
+    // Move the last tip into the hole and restore the heap around it
+    int position = tip_positions[block_id];
+    int last_tip = tips.back();
+    tips[position] = last_tip;
+    tip_positions[last_tip] = position;
+    tips.pop_back();
+    tip_positions[block_id] = -1;
+
+    if (position < static_cast<int>(tips.size()))
+    {
+        SiftTipUp(position);
+        SiftTipDown(tip_positions[last_tip]);
+    }
 }
 
-std::vector<const Block*>
-Blockchain::GetChildrenPointers(const Block& block)
+void
+Blockchain::SiftTipUp(int position)
 {
-    std::vector<const Block*> children_pointers;
-    auto it = children.find(block.header.block_id);
-    if (it != children.end())
+    while (position > 0)
     {
-        for (int child_id : it->second)
+        int parent_position = (position - 1) / 2;
+        if (!IsPreferredTip(tips[position], tips[parent_position]))
         {
-            auto block_it = blocks.find(child_id);
-            if (block_it != blocks.end())
+            break;
+        }
+        SwapTips(position, parent_position);
+        position = parent_position;
+    }
+}
+
+void
+Blockchain::SiftTipDown(int position)
+{
+    int size = static_cast<int>(tips.size());
+    while (true)
+    {
+        int best = position;
+        for (int child = 2 * position + 1; child <= 2 * position + 2 && child < size; child++)
+        {
+            if (IsPreferredTip(tips[child], tips[best]))
             {
-                children_pointers.push_back(&(block_it->second));
+                best = child;
             }
         }
+        if (best == position)
+        {
+            break;
+        }
+        SwapTips(position, best);
+        position = best;
     }
-    return children_pointers;
 }
 
-std::vector<const Block*>
-Blockchain::GetParentsPointers(const Block& block)
+void
+Blockchain::SwapTips(int position, int other_position)
+{
+    std::swap(tips[position], tips[other_position]);
+    tip_positions[tips[position]] = position;
+    tip_positions[tips[other_position]] = other_position;
+}
+
+void
+BlockStore::Reserve(int block_id)
 {
-    std::vector<const Block*> parent_pointers;
+    if (block_id < GetIdBound())
+    {
+        return;
+    }
+
+    int id_bound = block_id + 1;
+    present.EnsureBound(id_bound, false);
+    blue_score.EnsureBound(id_bound, 0);
+    selected_parent.EnsureBound(id_bound, -1);
+    is_blue.EnsureBound(id_bound, false);
+    parents_begin.EnsureBound(id_bound, 0);
+    parents_count.EnsureBound(id_bound, 0);
+    children_begin.EnsureBound(id_bound, 0);
+    children_count.EnsureBound(id_bound, 0);
+    children_capacity.EnsureBound(id_bound, 0);
+    bodies.EnsureBound(id_bound);
+}
+
+namespace
+{
+// Never destroyed, so contents released during static destruction can still unregister
+std::unordered_map<int, std::weak_ptr<const BlockContent>>&
+GetContentPool()
+{
+    static auto* pool = new std::unordered_map<int, std::weak_ptr<const BlockContent>>();
+    return *pool;
+}
+} // namespace
+
+std::shared_ptr<const BlockContent>
+InternBlockContent(const Block& block)
+{
+    int block_id = block.header.block_id;
+    std::weak_ptr<const BlockContent>& entry = GetContentPool()[block_id];
+
+    std::shared_ptr<const BlockContent> content = entry.lock();
+    if (content && (content->complete || !block.has_body))
+    {
+        return content;
+    }
+
+    BlockContent* created = new BlockContent{block.header.miner_id,
+                                             block.header.time_created,
+                                             block.size_in_bytes,
+                                             block.has_body,
+                                             block.has_body ? block.transactions
+                                                            : std::set<Transaction>()};
+    content.reset(created, [block_id](const BlockContent* released) {
+        // A complete content may have replaced this header-only one in the pool
+        auto it = GetContentPool().find(block_id);
+        if (it != GetContentPool().end() && it->second.expired())
+        {
+            GetContentPool().erase(it);
+        }
+        delete released;
+    });
+    entry = content;
+    return content;
+}
+
+size_t
+GetInternedBlockCount()
+{
+    return GetContentPool().size();
+}
+
+void
+BlockStore::Add(const Block& block)
+{
+    int block_id = block.header.block_id;
+    Reserve(block_id);
+
+    present[block_id] = true;
+    blue_score[block_id] = block.blue_score;
+    selected_parent[block_id] = block.selected_parent;
+    is_blue[block_id] = block.is_blue;
+
+    parents_begin[block_id] = static_cast<uint32_t>(parent_ids.size());
+    parents_count[block_id] = static_cast<uint32_t>(block.header.parent_hashes.size());
+    parent_ids.insert(parent_ids.end(),
+                      block.header.parent_hashes.begin(),
+                      block.header.parent_hashes.end());
+
+    BlockBody& body = bodies[block_id];
+    body.content = InternBlockContent(block);
+    body.time_received = block.time_received;
+    body.hop_count = block.hop_count;
+    body.received_from = block.received_from;
+    body.has_body = block.has_body;
+
     for (int parent_id : block.header.parent_hashes)
     {
-        auto block_it = blocks.find(parent_id);
-        if (block_it != blocks.end())
+        if (Has(parent_id))
         {
-            parent_pointers.push_back(&(block_it->second));
+            AddChild(parent_id, block_id);
         }
     }
-    return parent_pointers;
+
+    count++;
+}
+
+void
+BlockStore::AddChild(int parent_id, int child_id)
+{
+    uint32_t used = children_count[parent_id];
+
+    if (used == children_capacity[parent_id])
+    {
+        // Move the run to the end of the array with room to grow
+        uint32_t new_capacity = std::max<uint32_t>(2, used * 2);
+        uint32_t new_begin = static_cast<uint32_t>(child_ids.size());
+        child_ids.resize(child_ids.size() + new_capacity, -1);
+        std::copy(child_ids.begin() + children_begin[parent_id],
+                  child_ids.begin() + children_begin[parent_id] + used,
+                  child_ids.begin() + new_begin);
+
+        wasted_child_slots += children_capacity[parent_id];
+        children_begin[parent_id] = new_begin;
+        children_capacity[parent_id] = new_capacity;
+    }
+
+    child_ids[children_begin[parent_id] + used] = child_id;
+    children_count[parent_id] = used + 1;
+
+    if (wasted_child_slots * 2 > child_ids.size())
+    {
+        CompactChildren();
+    }
+}
+
+void
+BlockStore::CompactChildren()
+{
+    std::vector<int> compacted;
+    compacted.reserve(child_ids.size() - wasted_child_slots);
+
+    for (int block_id = GetFirstId(); block_id < GetIdBound(); block_id++)
+    {
+        uint32_t begin = static_cast<uint32_t>(compacted.size());
+        compacted.insert(compacted.end(),
+                         child_ids.begin() + children_begin[block_id],
+                         child_ids.begin() + children_begin[block_id] +
+                             children_capacity[block_id]);
+        children_begin[block_id] = begin;
+    }
+
+    child_ids.swap(compacted);
+    wasted_child_slots = 0;
+}
+
+void
+BlockStore::CompactParents()
+{
+    std::vector<int> compacted;
+    compacted.reserve(parent_ids.size() - wasted_parent_slots);
+
+    for (int block_id = GetFirstId(); block_id < GetIdBound(); block_id++)
+    {
+        uint32_t begin = static_cast<uint32_t>(compacted.size());
+        compacted.insert(compacted.end(),
+                         parent_ids.begin() + parents_begin[block_id],
+                         parent_ids.begin() + parents_begin[block_id] + parents_count[block_id]);
+        parents_begin[block_id] = begin;
+    }
+
+    parent_ids.swap(compacted);
+    wasted_parent_slots = 0;
+}
+
+void
+BlockStore::Remove(int block_id)
+{
+    if (!Has(block_id))
+    {
+        return;
+    }
+
+    present[block_id] = false;
+    count--;
+
+    DetachParents(block_id);
+    wasted_child_slots += children_capacity[block_id];
+    children_count[block_id] = 0;
+    children_capacity[block_id] = 0;
+    bodies[block_id] = BlockBody();
+}
+
+void
+BlockStore::DetachParents(int block_id)
+{
+    wasted_parent_slots += parents_count[block_id];
+    parents_count[block_id] = 0;
+}
+
+void
+BlockStore::DropMissingLinks(int block_id)
+{
+    // Filter both runs in place; freed parent slots are reclaimed by CompactParents and
+    // freed child slots stay as spare capacity
+    int* parents_first = parent_ids.data() + parents_begin[block_id];
+    int* parents_last = std::remove_if(parents_first,
+                                       parents_first + parents_count[block_id],
+                                       [this](int id) { return !Has(id); });
+    uint32_t kept_parents = static_cast<uint32_t>(parents_last - parents_first);
+    wasted_parent_slots += parents_count[block_id] - kept_parents;
+    parents_count[block_id] = kept_parents;
+
+    int* children_first = child_ids.data() + children_begin[block_id];
+    int* children_last = std::remove_if(children_first,
+                                        children_first + children_count[block_id],
+                                        [this](int id) { return !Has(id); });
+    children_count[block_id] = static_cast<uint32_t>(children_last - children_first);
+}
+
+void
+BlockStore::DropBelow(int block_id)
+{
+    present.DropBelow(block_id);
+    blue_score.DropBelow(block_id);
+    selected_parent.DropBelow(block_id);
+    is_blue.DropBelow(block_id);
+    parents_begin.DropBelow(block_id);
+    parents_count.DropBelow(block_id);
+    children_begin.DropBelow(block_id);
+    children_count.DropBelow(block_id);
+    children_capacity.DropBelow(block_id);
+    bodies.DropBelow(block_id);
+
+    if (wasted_parent_slots * 2 > parent_ids.size())
+    {
+        CompactParents();
+    }
+    if (wasted_child_slots * 2 > child_ids.size())
+    {
+        CompactChildren();
+    }
+}
+
+Block
+BlockStore::GetBlock(int block_id) const
+{
+    Block block;
+    if (!Has(block_id))
+    {
+        return block;
+    }
+
+    const BlockBody& body = bodies[block_id];
+    block.header.block_id = block_id;
+    block.header.miner_id = body.content->miner_id;
+    block.header.time_created = body.content->time_created;
+    for (int parent_id : GetParents(block_id))
+    {
+        block.header.parent_hashes.push_back(parent_id);
+    }
+    if (body.has_body)
+    {
+        block.transactions = body.content->transactions;
+    }
+    block.size_in_bytes = body.content->size_in_bytes;
+    block.time_received = body.time_received;
+    block.received_from = body.received_from;
+    block.hop_count = body.hop_count;
+    block.has_body = body.has_body;
+    block.blue_score = blue_score[block_id];
+    block.is_blue = is_blue[block_id];
+    block.selected_parent = selected_parent[block_id];
+    return block;
+}
+
+BlockHeader
+BlockStore::GetHeader(int block_id) const
+{
+    BlockHeader header;
+    if (!Has(block_id))
+    {
+        return header;
+    }
+
+    const BlockBody& body = bodies[block_id];
+    header.block_id = block_id;
+    header.miner_id = body.content->miner_id;
+    header.time_created = body.content->time_created;
+    for (int parent_id : GetParents(block_id))
+    {
+        header.parent_hashes.push_back(parent_id);
+    }
+    return header;
+}
+
+void
+OrphanPool::Add(const Block& block, const std::vector<int>& missing_parents)
+{
+    int block_id = block.header.block_id;
+    if (Has(block_id) || max_orphans == 0)
+    {
+        return;
+    }
+
+    while (entries.size() >= max_orphans)
+    {
+        Remove(age_order.front());
+        evicted_count++;
+    }
+
+    age_order.push_back(block_id);
+    entries[block_id] = Entry{block, static_cast<int>(missing_parents.size()), --age_order.end()};
+
+    for (int parent_id : missing_parents)
+    {
+        waiting_on[parent_id].push_back(block_id);
+    }
+}
+
+void
+OrphanPool::ReleaseChildren(int parent_id, std::vector<Block>& ready)
+{
+    auto waiting_it = waiting_on.find(parent_id);
+    if (waiting_it == waiting_on.end())
+    {
+        return;
+    }
+
+    std::vector<int> waiting = std::move(waiting_it->second);
+    waiting_on.erase(waiting_it);
+
+    for (int orphan_id : waiting)
+    {
+        auto it = entries.find(orphan_id);
+        if (it == entries.end() || --it->second.missing_parents > 0)
+        {
+            continue;
+        }
+
+        ready.push_back(std::move(it->second.block));
+        age_order.erase(it->second.age_position);
+        entries.erase(it);
+    }
+}
+
+void
+OrphanPool::Remove(int block_id)
+{
+    auto it = entries.find(block_id);
+    if (it == entries.end())
+    {
+        return;
+    }
+
+    // Drop the orphan from the index of every parent it still waits on
+    for (int parent_id : it->second.block.header.parent_hashes)
+    {
+        auto waiting_it = waiting_on.find(parent_id);
+        if (waiting_it == waiting_on.end())
+        {
+            continue;
+        }
+
+        std::vector<int>& waiting = waiting_it->second;
+        waiting.erase(std::remove(waiting.begin(), waiting.end(), block_id), waiting.end());
+        if (waiting.empty())
+        {
+            waiting_on.erase(waiting_it);
+        }
+    }
+
+    age_order.erase(it->second.age_position);
+    entries.erase(it);
 }
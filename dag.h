@@ -1,8 +1,16 @@
 #pragma once
 
+#include "block_id_vector.h"
+#include "block_set.h"
+#include "reachability.h"
+
 #include "ns3/ipv4-address.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <unordered_map>
 #include <vector>
@@ -40,6 +48,7 @@ typedef struct
 
     double total_validation_time;
     int max_dag_width_seen;
+    int dag_width;
 
     double mempool_similarity_score;
 } NodeStats;
@@ -104,6 +113,14 @@ enum Messages
     TRANSACTION,
 
     REQ_ANTIPAST,
+
+    COMPACT_BLOCK,
+    REQ_BLOCK_TRANSACTIONS,
+    BLOCK_TRANSACTIONS,
+
+    REQ_RECONCILIATION,
+    RECONCILIATION_SKETCH,
+    RECONCILIATION_DIFF,
 };
 
 struct BlockHeader
@@ -140,6 +157,11 @@ struct Transaction
     int tx_id;
     double arrival_time;
     int size_bytes;
+
+    bool operator<(const Transaction& other) const
+    {
+        return tx_id < other.tx_id;
+    }
 };
 
 struct Block
@@ -155,6 +177,7 @@ struct Block
     int blue_score;
     bool is_blue;
     int selected_parent;
+    bool has_body; // false for headers stored ahead of their transactions during IBD
 
     Block()
         : size_in_bytes(0),
@@ -162,7 +185,8 @@ struct Block
           hop_count(0),
           blue_score(0),
           is_blue(false),
-          selected_parent(-1)
+          selected_parent(-1),
+          has_body(true)
     {
     }
 
@@ -265,11 +289,249 @@ struct Mempool
     }
 };
 
+// Contiguous view over block ids stored in a flat array. Ranges returned by BlockStore
+// are invalidated by the next block added to it.
+struct BlockIdRange
+{
+    const int* first;
+    const int* last;
+
+    const int* begin() const
+    {
+        return first;
+    }
+
+    const int* end() const
+    {
+        return last;
+    }
+
+    int size() const
+    {
+        return static_cast<int>(last - first);
+    }
+
+    bool empty() const
+    {
+        return first == last;
+    }
+};
+
+// The part of a block that is the same for every node. Each block id has one shared
+// copy per process, freed with its last holder, so storing a block on N nodes costs its
+// transactions once.
+struct BlockContent
+{
+    int miner_id;
+    double time_created;
+    int size_in_bytes;
+    bool complete; // transactions included, not only the header
+    std::set<Transaction> transactions;
+};
+
+// The shared content of the block, created on first use. A header-only content is
+// reused for complete blocks only until one with transactions is interned.
+std::shared_ptr<const BlockContent> InternBlockContent(const Block& block);
+
+// Block ids with a live shared content
+size_t GetInternedBlockCount();
+
+// Cold per-block data that the GHOSTDAG hot paths never touch. The content is shared,
+// the rest is this node's view of the block.
+struct BlockBody
+{
+    std::shared_ptr<const BlockContent> content;
+    double time_received;
+    int hop_count;
+    bool has_body;
+    ns3::Ipv4Address received_from;
+
+    BlockBody()
+        : time_received(0),
+          hop_count(0),
+          has_body(true)
+    {
+    }
+};
+
+// Block storage indexed directly by block id. Hot GHOSTDAG fields are parallel arrays,
+// parents and children are CSR-style flat adjacency arrays and bodies are kept apart.
+struct BlockStore
+{
+    BlockStore()
+        : count(0),
+          wasted_parent_slots(0),
+          wasted_child_slots(0)
+    {
+    }
+
+    int count;
+
+    BlockIdVector<uint8_t> present;
+    BlockIdVector<int> blue_score;
+    BlockIdVector<int> selected_parent;
+    BlockIdVector<uint8_t> is_blue;
+
+    // Parents never change once a block is stored, so they are appended back to back
+    BlockIdVector<uint32_t> parents_begin;
+    BlockIdVector<uint32_t> parents_count;
+    std::vector<int> parent_ids;
+    size_t wasted_parent_slots;
+
+    // Children grow after insertion: each block owns a slot run in child_ids that is moved
+    // to the end with double the capacity when full, and the array is compacted once
+    // half of it is abandoned runs
+    BlockIdVector<uint32_t> children_begin;
+    BlockIdVector<uint32_t> children_count;
+    BlockIdVector<uint32_t> children_capacity;
+    std::vector<int> child_ids;
+    size_t wasted_child_slots;
+
+    BlockIdVector<BlockBody> bodies;
+
+    bool Has(int block_id) const
+    {
+        return present.InWindow(block_id) && present[block_id];
+    }
+
+    int GetCount() const
+    {
+        return count;
+    }
+
+    // Every stored id is in [GetFirstId(), GetIdBound())
+    int GetFirstId() const
+    {
+        return present.GetFirstId();
+    }
+
+    int GetIdBound() const
+    {
+        return present.GetIdBound();
+    }
+
+    BlockIdRange GetParents(int block_id) const
+    {
+        const int* first = parent_ids.data() + parents_begin[block_id];
+        return BlockIdRange{first, first + parents_count[block_id]};
+    }
+
+    BlockIdRange GetChildren(int block_id) const
+    {
+        const int* first = child_ids.data() + children_begin[block_id];
+        return BlockIdRange{first, first + children_count[block_id]};
+    }
+
+    void Add(const Block& block);
+    void AddChild(int parent_id, int child_id);
+    void Remove(int block_id);
+    void DetachParents(int block_id);
+    void DropMissingLinks(int block_id);
+    void DropBelow(int block_id);
+    void CompactParents();
+    void CompactChildren();
+    void Reserve(int block_id);
+    Block GetBlock(int block_id) const;
+    BlockHeader GetHeader(int block_id) const;
+};
+
+// Blocks waiting for parents that are not stored yet, indexed by the parent they wait
+// on so that a new block releases exactly its waiting children. The pool is bounded and
+// evicts the oldest orphan when full.
+struct OrphanPool
+{
+    struct Entry
+    {
+        Block block;
+        int missing_parents;
+        std::list<int>::iterator age_position;
+    };
+
+    OrphanPool(size_t max_size = 1000)
+        : max_orphans(max_size),
+          evicted_count(0)
+    {
+    }
+
+    size_t max_orphans;
+    long evicted_count;
+
+    std::unordered_map<int, Entry> entries;
+    std::unordered_map<int, std::vector<int>> waiting_on; // missing parent -> orphan ids
+    std::list<int> age_order;                             // oldest orphan first
+
+    bool Has(int block_id) const
+    {
+        return entries.find(block_id) != entries.end();
+    }
+
+    size_t GetCount() const
+    {
+        return entries.size();
+    }
+
+    void Add(const Block& block, const std::vector<int>& missing_parents);
+    void ReleaseChildren(int parent_id, std::vector<Block>& ready);
+    void Remove(int block_id);
+
+    // Drops every orphan with a parent is_gone holds for, e.g. a pruned one, along with
+    // the orphans waiting on those
+    template <typename Predicate>
+    void RemoveWithParent(Predicate is_gone)
+    {
+        std::vector<int> doomed;
+        for (const auto& [block_id, entry] : entries)
+        {
+            const std::vector<int>& parents = entry.block.header.parent_hashes;
+            if (std::any_of(parents.begin(), parents.end(), is_gone))
+            {
+                doomed.push_back(block_id);
+            }
+        }
+
+        while (!doomed.empty())
+        {
+            int block_id = doomed.back();
+            doomed.pop_back();
+            if (!Has(block_id))
+            {
+                continue;
+            }
+            Remove(block_id);
+
+            auto waiting_it = waiting_on.find(block_id);
+            if (waiting_it != waiting_on.end())
+            {
+                doomed.insert(doomed.end(), waiting_it->second.begin(), waiting_it->second.end());
+            }
+        }
+    }
+};
+
+struct GhostdagData
+{
+    int blue_score;
+    int selected_parent;
+    std::vector<int> mergeset_blues; // selected parent first, then blues by (blue_score, id)
+    std::vector<int> mergeset_reds;
+    std::unordered_map<int, int> blues_anticone_sizes;
+
+    GhostdagData()
+        : blue_score(0),
+          selected_parent(-1)
+    {
+    }
+};
+
 struct Blockchain
 {
-    Blockchain(int k = 0)
+    Blockchain(int k = 0, int pruning_depth = 0)
         : ghostdag_k(k),
-          next_block_id(0)
+          next_block_id(0),
+          pruning_depth(pruning_depth),
+          pruned_block_count(0),
+          chain_offset(0),
+          ordering_offset(0)
     {
         Block genesis;
         genesis.header.block_id = GetNextBlockId();
@@ -281,8 +543,18 @@ struct Blockchain
         genesis.is_blue = true;
         genesis.selected_parent = -1;
 
-        blocks[genesis.header.block_id] = genesis;
-        tips.insert(genesis.header.block_id);
+        blocks.Add(genesis);
+        AddTip(genesis.header.block_id);
+
+        ghostdag_data.EnsureBound(genesis.header.block_id + 1);
+        ghostdag_data[genesis.header.block_id].blue_score = genesis.blue_score;
+        reachability.AddRoot(genesis.header.block_id);
+
+        chain_positions.EnsureBound(genesis.header.block_id + 1, -1);
+        ordering_positions.EnsureBound(genesis.header.block_id + 1, -1);
+        AppendChainBlock(genesis.header.block_id);
+        pruning_point = genesis.header.block_id;
+        UpdateVirtual();
     }
 
     virtual ~Blockchain()
@@ -292,33 +564,164 @@ struct Blockchain
     int ghostdag_k;
     int next_block_id;
 
-    std::set<int> tips;
-    std::map<int, std::set<int>> children;
-    std::map<int, Block> blocks;
-    std::map<int, Block> orphans;
+    // Tips form a binary heap with the preferred tip, by (blue_score, lowest id), first
+    std::vector<int> tips;
+    BlockIdVector<int> tip_positions; // index in tips by block id, -1 if not a tip
+    BlockStore blocks;
+    OrphanPool orphans;
+    BlockIdVector<GhostdagData> ghostdag_data;
+    Reachability reachability;
+
+    // GHOSTDAG data of a virtual block with every tip as a parent, refreshed after each
+    // added block
+    GhostdagData virtual_data;
+
+    // Pruning keeps the pruning point, its future and the part of its anticone still
+    // merged by live tips. It moves along the selected chain to pruning_depth blue score
+    // behind the selected tip, in steps of pruning_depth so the cost is amortized.
+    // A pruning_depth of 0 disables pruning.
+    int pruning_depth;
+    int pruning_point;
+    long pruned_block_count;
+
+    // GHOSTDAG ordering of the selected tip and its past, maintained along the selected
+    // chain: each chain block appends its mergeset sorted by (blue_score, id), then itself.
+    // Positions are global and stay valid when pruning drops the front of the chain.
+    std::vector<int> selected_chain;        // pruning point (genesis until pruned) first
+    int chain_offset;                       // global chain position of selected_chain[0]
+    BlockIdVector<int> chain_positions;     // global chain position by id, -1 if off chain
+    std::vector<int> chain_ordering_starts; // ordering position of each chain segment
+    std::vector<int> ordering;
+    int ordering_offset;                   // global position of ordering[0]
+    BlockIdVector<int> ordering_positions; // global position by id, -1 if not ordered yet
 
     int GetDagWidth() const;
     bool HasBlock(int block_id) const;
     bool IsRed(int block_id) const;
     bool IsOrphan(int block_id) const;
 
-    std::vector<const Block*> GetChildrenPointers(const Block& block);
-    std::vector<const Block*> GetParentsPointers(const Block& block);
+    Block GetBlock(int block_id) const;
+    BlockHeader GetHeader(int block_id) const;
+    BlockIdRange GetChildren(int block_id) const;
+    BlockIdRange GetParents(int block_id) const;
+
+    void AddTip(int block_id);
+    void RemoveTip(int block_id);
+    void SiftTipUp(int position);
+    void SiftTipDown(int position);
+    void SwapTips(int position, int other_position);
 
     void AddBlock(const Block& new_block);
+    bool ConnectBlock(const Block& block);
+
+    // Headers-first sync: a header is stored and coloured like a block without
+    // transactions, and its body is filled in once downloaded
+    void AddHeader(const BlockHeader& header);
+    void SetBody(const Block& body);
+
+    bool HasBody(int block_id) const
+    {
+        return blocks.Has(block_id) && blocks.bodies[block_id].has_body;
+    }
+
+    // Up to max_count ids in GHOSTDAG order from global ordering position start on,
+    // followed by the blocks outside the selected tip's past
+    std::vector<int> GetOrderedBlocksFrom(int start, int max_count) const;
+
+    // Selected chain blocks from global chain position high down to low, both included,
+    // with blue score gaps doubling from one entry to the next
+    std::vector<int> GetChainLocator(int high, int low) const;
+
+    int GetChainPosition(int block_id) const
+    {
+        return IsOnSelectedChain(block_id) ? chain_positions[block_id] : -1;
+    }
+
+    // Blocks that are neither in known nor in the past of any of them, in topological
+    // order. Ids of known that aren't stored are ignored.
+    std::vector<int> GetAntipast(const std::vector<int>& known) const;
 
     std::set<int> GetPast(int block_id);
     std::set<int> GetFuture(int block_id);
     std::set<int> GetAnticone(int block_id, int other_block_id);
 
+    BlockSet GetPastSet(int block_id) const;
+    BlockSet GetFutureSet(int block_id) const;
+    BlockSet GetAnticoneSet(int block_id, int other_block_id) const;
+    BlockSet GetAllBlocksSet() const;
+
     std::set<int> CalculateBlueSet(int block_id);
     std::set<int> GreedyBlueSet(int block_id);
     int CalculateBlueScore(int block_id, const std::set<int>& blue_set);
     bool IsKCluster(const std::set<int>& blue_set);
 
-    int SelectTip();
+    // Incremental GHOSTDAG: only the mergeset of the new block is coloured
+    GhostdagData ComputeGhostdag(const std::vector<int>& parents);
+    int FindSelectedParent(const std::vector<int>& parents);
+    std::vector<int> ComputeMergeset(int selected_parent, const std::vector<int>& parents);
+    bool CheckBlueCandidate(const GhostdagData& new_block_data,
+                            int candidate,
+                            std::unordered_map<int, int>& candidate_blues_anticone_sizes,
+                            int& candidate_anticone_size);
+    int BlueAnticoneSize(int block_id, const GhostdagData& context) const;
+
+    bool IsDagAncestorOf(int ancestor_id, int descendant_id) const;
+    bool IsInAnticone(int block_id, int other_block_id) const;
+
+    int SelectTip() const;
+    bool IsPreferredTip(int block_id, int other_block_id) const;
     std::vector<int> ComputeGHOSTDAGOrdering();
 
+    int GetSelectedTip() const
+    {
+        return selected_chain.back();
+    }
+
+    int GetOrderingPosition(int block_id) const
+    {
+        if (!ordering_positions.InWindow(block_id))
+        {
+            return -1;
+        }
+        return ordering_positions[block_id];
+    }
+
+    bool IsOnSelectedChain(int block_id) const
+    {
+        return chain_positions.InWindow(block_id) && chain_positions[block_id] != -1;
+    }
+
+    void UpdateVirtual();
+
+    const GhostdagData& GetVirtualData() const
+    {
+        return virtual_data;
+    }
+
+    int GetVirtualBlueScore() const
+    {
+        return virtual_data.blue_score;
+    }
+
+    // Parents for a block mined on top of the current DAG
+    const std::vector<int>& GetVirtualParents() const
+    {
+        return tips;
+    }
+
+    void UpdateSelectedChain(int new_selected_tip);
+    void AppendChainBlock(int chain_block);
+    std::vector<int> SortedMergeset(const GhostdagData& data) const;
+    void SortByBlueScore(std::vector<int>& block_ids) const;
+
+    void AdvancePruningPoint();
+    void PruneTo(int new_pruning_point);
+
+    long GetTotalBlockCount() const
+    {
+        return blocks.GetCount() + pruned_block_count;
+    }
+
     int GetNextBlockId()
     {
         return next_block_id++;
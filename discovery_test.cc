@@ -1,80 +1,243 @@
 #include "node.h"
+#include "stats_sampler.h"
+#include "stats_writer.h"
+#include "underlay.h"
 
 #include "ns3/applications-module.h"
 #include "ns3/core-module.h"
 #include "ns3/internet-module.h"
 #include "ns3/network-module.h"
-#include "ns3/point-to-point-module.h"
+
+#ifdef NS3_MPI
+#include "ns3/mpi-interface.h"
+#endif
+
+#include <fstream>
+#include <iomanip>
 
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE("GhostDagMain");
 
-Ipv4Address
-GetNodeIp(Ptr<Node> n)
-{
-    Ptr<Ipv4> ipv4 = n->GetObject<Ipv4>();
-    return ipv4->GetAddress(1, 0).GetLocal();
-}
-
 int
 main(int argc, char* argv[])
 {
     uint32_t numNodes = 20;
     uint32_t maxPeers = 6;
+    uint32_t kGhostdag = 10;
+    uint32_t pruningDepth = 0;
+    uint32_t numMiners = 0;
+    double blockInterval = 1.0;
+    double txInterval = 0;
+    bool compactBlocks = true;
+    bool txReconciliation = false;
+    double trickleInterval = 0.5;
+    bool bandwidthSpread = false;
+    double accessRate = 0;
+    uint32_t lateNodes = 0;
+    double lateStart = 30.0;
+    double stopTime = 60.0;
+    bool distributed = false;
+    bool nullMessage = false;
+    std::string regionMatrix;
+    std::string statsFile;
+    double sampleInterval = 0;
+    std::string sampleFile = "stats_series.csv";
 
     CommandLine cmd;
     cmd.AddValue("numNodes", "Number of GhostDag nodes", numNodes);
     cmd.AddValue("maxPeers", "Max peers per node", maxPeers);
+    cmd.AddValue("kGhostdag", "GHOSTDAG K of every node", kGhostdag);
+    cmd.AddValue("pruningDepth", "Blue score depth at which nodes prune (0 = off)", pruningDepth);
+    cmd.AddValue("numMiners", "Number of mining nodes, sharing the hash rate equally", numMiners);
+    cmd.AddValue("blockInterval",
+                 "Mean seconds between blocks of the whole network",
+                 blockInterval);
+    cmd.AddValue("txInterval",
+                 "Mean seconds between transactions of each node (0 = off)",
+                 txInterval);
+    cmd.AddValue("compactBlocks", "Relay blocks as header plus transaction ids", compactBlocks);
+    cmd.AddValue("txReconciliation",
+                 "Flood transactions to a few peers and reconcile with the rest",
+                 txReconciliation);
+    cmd.AddValue("trickleInterval",
+                 "Mean seconds between transaction announcements to a peer (0 = unbatched)",
+                 trickleInterval);
+    cmd.AddValue("bandwidthSpread",
+                 "Give nodes random 10-100 Mbps links with uploads serialized at that speed",
+                 bandwidthSpread);
+    cmd.AddValue("accessRate",
+                 "Mbps of every node's access link without bandwidthSpread (0 = 100)",
+                 accessRate);
+    cmd.AddValue("regionMatrix",
+                 "File with the region latency (ms) and backbone bandwidth (Mbps) matrices",
+                 regionMatrix);
+    cmd.AddValue("lateNodes", "Number of nodes that join late and sync from peers", lateNodes);
+    cmd.AddValue("lateStart", "Seconds at which the late nodes start", lateStart);
+    cmd.AddValue("stopTime", "Seconds at which the simulation stops", stopTime);
+    cmd.AddValue("distributed",
+                 "Split the regions over MPI processes, e.g. under mpirun -np 4",
+                 distributed);
+    cmd.AddValue("nullMessage",
+                 "Synchronize processes with null messages instead of global barriers",
+                 nullMessage);
+    cmd.AddValue("statsFile",
+                 "CSV file for the final stats of every node, one per process when distributed",
+                 statsFile);
+    cmd.AddValue("sampleInterval",
+                 "Seconds between snapshots of every node's stats (0 = off)",
+                 sampleInterval);
+    cmd.AddValue("sampleFile",
+                 "CSV file for the stats snapshots, one per process when distributed",
+                 sampleFile);
     cmd.Parse(argc, argv);
 
+    uint32_t systemId = 0;
+    uint32_t systemCount = 1;
+    if (distributed)
+    {
+#ifdef NS3_MPI
+        GlobalValue::Bind("SimulatorImplementationType",
+                          StringValue(nullMessage ? "ns3::NullMessageSimulatorImpl"
+                                                  : "ns3::DistributedSimulatorImpl"));
+        MpiInterface::Enable(&argc, &argv);
+        systemId = MpiInterface::GetSystemId();
+        systemCount = MpiInterface::GetSize();
+        GhostDagNode::SetIdPartition(systemId, systemCount);
+#else
+        NS_FATAL_ERROR("distributed needs ns-3 configured with --enable-mpi");
+#endif
+    }
+
     LogComponentEnable("GhostDagMain", LOG_LEVEL_INFO);
     LogComponentEnable("GhostDagNode", LOG_LEVEL_INFO);
 
-    // ---- Create nodes ----
-    NodeContainer nodes;
-    nodes.Create(numNodes);
-
-    InternetStackHelper internet;
-    internet.Install(nodes);
+    // Created before any app so they get the same streams, and draw the same topology,
+    // in every process
+    Ptr<UniformRandomVariable> speedRng = CreateObject<UniformRandomVariable>();
+    Ptr<UniformRandomVariable> rng = CreateObject<UniformRandomVariable>();
 
-    // ---- Point-to-point full underlay (IP reachability) ----
-    PointToPointHelper p2p;
-    p2p.SetDeviceAttribute("DataRate", StringValue("50Mbps"));
-    p2p.SetChannelAttribute("Delay", StringValue("2ms"));
+    RegionUnderlayConfig regionConfig = GetDefaultRegionConfig();
+    if (!regionMatrix.empty() && !LoadRegionMatrices(regionMatrix, regionConfig))
+    {
+        NS_FATAL_ERROR("Cannot read the region matrices from " << regionMatrix);
+    }
+    if (accessRate > 0)
+    {
+        regionConfig.access_rate = DataRate(static_cast<uint64_t>(accessRate * 1e6));
+    }
 
+    std::vector<Region> regions;
+    std::vector<NodeInternetSpeeds> speeds;
+    std::vector<double> accessMbps;
     for (uint32_t i = 0; i < numNodes; ++i)
     {
-        for (uint32_t j = i + 1; j < numNodes; ++j)
-        {
-            NetDeviceContainer devs = p2p.Install(nodes.Get(i), nodes.Get(j));
-
-            std::ostringstream subnet;
-            subnet << "10." << i + 1 << "." << j + 1 << ".0";
+        regions.push_back(PickRegion(regionConfig, rng->GetValue()));
 
-            Ipv4AddressHelper ipv4;
-            ipv4.SetBase(subnet.str().c_str(), "255.255.255.0");
-            ipv4.Assign(devs);
+        // Download in Mbps, upload at most as fast, as on asymmetric home links
+        NodeInternetSpeeds nodeSpeeds;
+        nodeSpeeds.download_speed = speedRng->GetValue(10, 100);
+        nodeSpeeds.upload_speed = speedRng->GetValue(5, nodeSpeeds.download_speed);
+        speeds.push_back(nodeSpeeds);
+        if (bandwidthSpread)
+        {
+            accessMbps.push_back(nodeSpeeds.download_speed);
         }
     }
 
+    // ---- Create nodes ----
+    // Every process builds the whole network. Each region belongs to one of them, with
+    // its routers, so only the backbone crosses processes; nodes only get their app in
+    // the process that owns them.
+    std::vector<uint32_t> regionOwners = PartitionRegions(regions, systemCount);
+    NodeContainer nodes;
+    for (uint32_t i = 0; i < numNodes; ++i)
+    {
+        nodes.Add(CreateObject<Node>(regionOwners[regions[i]]));
+    }
+
+    InternetStackHelper internet;
+    internet.Install(nodes);
+
+    // ---- Region underlay (IP reachability) ----
+    // Backbone links between regions of different processes become remote channels,
+    // and the smallest of their delays is the lookahead the processes synchronize on
+    RegionUnderlay underlay(regionConfig);
+    underlay.Install(nodes, regions, accessMbps);
+
     // ---- Install GhostDag apps ----
     std::vector<Ptr<GhostDagNode>> apps;
+    std::vector<double> startTimes;
+    std::vector<NodeStats> stats(numNodes, NodeStats());
 
     for (uint32_t i = 0; i < numNodes; ++i)
     {
+        // The last lateNodes nodes join once the DAG has grown and must catch up
+        double startTime = (i + lateNodes >= numNodes ? lateStart : 1.0) + i * 0.05;
+        startTimes.push_back(startTime);
+
+        if (nodes.Get(i)->GetSystemId() != systemId)
+        {
+            apps.push_back(nullptr);
+            continue;
+        }
+
         Ptr<GhostDagNode> app = CreateObject<GhostDagNode>();
         app->SetAttribute("Local", AddressValue(InetSocketAddress(Ipv4Address::GetAny(), 16443)));
         app->SetAttribute("MaxPeers", UintegerValue(maxPeers));
+        app->SetAttribute("Kghostdag", UintegerValue(kGhostdag));
+        // Each gateway's /24 is one address group, as a region's /11 is far too coarse
+        app->SetAttribute("AddressGroupBits",
+                          UintegerValue(RegionUnderlay::GATEWAY_PREFIX_LENGTH));
+        app->SetAttribute("AddressTableSize", UintegerValue(numNodes));
+        app->SetAttribute("PruningDepth", UintegerValue(pruningDepth));
+        app->SetAttribute("CompactBlocks", BooleanValue(compactBlocks));
+        app->SetAttribute("TransactionInterval", TimeValue(Seconds(txInterval)));
+        app->SetAttribute("TxReconciliation", BooleanValue(txReconciliation));
+        app->SetAttribute("TrickleInterval", TimeValue(Seconds(trickleInterval)));
+        if (bandwidthSpread)
+        {
+            app->SetNodeInternetSpeeds(speeds[i]);
+            app->SetAttribute("SerializationDelay", BooleanValue(true));
+        }
+        if (i < numMiners)
+        {
+            app->SetAttribute("IsMiner", BooleanValue(true));
+            app->SetAttribute("BlockInterval", TimeValue(Seconds(blockInterval * numMiners)));
+            stats[i].hash_rate = 1.0 / numMiners;
+        }
+        if (!statsFile.empty() || sampleInterval > 0)
+        {
+            app->SetNodeStats(&stats[i]);
+        }
 
         nodes.Get(i)->AddApplication(app);
-        app->SetStartTime(Seconds(1.0 + i * 0.05));
-        app->SetStopTime(Seconds(60.0));
+        app->SetStartTime(Seconds(startTime));
+        app->SetStopTime(Seconds(stopTime));
 
         apps.push_back(app);
     }
 
-    Ptr<UniformRandomVariable> rng = CreateObject<UniformRandomVariable>();
+    // Links are made once both ends are running, by the ends local to this process
+    auto connect = [&](uint32_t a, uint32_t b) {
+        Ptr<GhostDagNode> appA = apps[a];
+        Ptr<GhostDagNode> appB = apps[b];
+        Ipv4Address ipA = underlay.GetAddress(a);
+        Ipv4Address ipB = underlay.GetAddress(b);
+        double at = std::max(startTimes[a], startTimes[b]) + 0.1;
+        double delay = std::max(0.0, at - Simulator::Now().GetSeconds());
+
+        Simulator::Schedule(Seconds(delay), [appA, appB, ipA, ipB]() {
+            if (appA)
+            {
+                appA->ConnectToPeer(ipB, 16443);
+            }
+            if (appB)
+            {
+                appB->ConnectToPeer(ipA, 16443);
+            }
+        });
+    };
 
     // ---- Build connected overlay topology ----
     Simulator::Schedule(Seconds(2.0), [&]() {
@@ -85,11 +248,7 @@ main(int argc, char* argv[])
         {
             uint32_t parent = rng->GetInteger(0, i - 1);
 
-            Ipv4Address ipP = GetNodeIp(nodes.Get(parent));
-            Ipv4Address ipC = GetNodeIp(nodes.Get(i));
-
-            apps[parent]->ConnectToPeer(ipC, 16443);
-            apps[i]->ConnectToPeer(ipP, 16443);
+            connect(parent, i);
 
             NS_LOG_INFO("Link: " << parent << " <-> " << i);
         }
@@ -106,19 +265,66 @@ main(int argc, char* argv[])
                 continue;
             }
 
-            Ipv4Address ipA = GetNodeIp(nodes.Get(a));
-            Ipv4Address ipB = GetNodeIp(nodes.Get(b));
-
-            apps[a]->ConnectToPeer(ipB, 16443);
-            apps[b]->ConnectToPeer(ipA, 16443);
+            connect(a, b);
 
             NS_LOG_INFO("Extra link: " << a << " <-> " << b);
         }
     });
 
-    Simulator::Stop(Seconds(60.0));
+    StatsSampler sampler;
+    if (sampleInterval > 0)
+    {
+        std::string path = sampleFile;
+        if (systemCount > 1)
+        {
+            path += "." + std::to_string(systemId);
+        }
+        if (!sampler.Open(path))
+        {
+            NS_FATAL_ERROR("Cannot create the stats samples file " << path);
+        }
+        sampler.Start(Seconds(sampleInterval), apps);
+    }
+
+    // Stopping a moment after the apps lets them fill in their final stats; events at
+    // the stop time itself would be cut off
+    Simulator::Stop(Seconds(stopTime) + MilliSeconds(1));
     Simulator::Run();
+    sampler.Stop();
+
+    if (!statsFile.empty())
+    {
+        std::string path = statsFile;
+        if (systemCount > 1)
+        {
+            path += "." + std::to_string(systemId);
+        }
+        std::ofstream out(path);
+        out << std::setprecision(9);
+        WriteNodeStatsHeader(out);
+        out << "\n";
+        for (uint32_t i = 0; i < numNodes; ++i)
+        {
+            if (apps[i])
+            {
+                WriteNodeStatsRow(out, stats[i]);
+                out << "\n";
+            }
+        }
+        if (!out)
+        {
+            NS_FATAL_ERROR("Cannot write the stats to " << path);
+        }
+    }
+
     Simulator::Destroy();
 
+#ifdef NS3_MPI
+    if (distributed)
+    {
+        MpiInterface::Disable();
+    }
+#endif
+
     return 0;
 }
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+// Murmur3 finalizer with a per-use seed, for cheap keyed hashing of 32-bit ids
+inline uint32_t
+Mix32(uint32_t value, uint32_t seed)
+{
+    uint32_t h = value ^ seed;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
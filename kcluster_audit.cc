@@ -0,0 +1,196 @@
+#include "kcluster_audit.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+// Blocks handed to a worker at a time, so workers rarely touch the shared counter
+const int AUDIT_CHUNK_SIZE = 256;
+} // namespace
+
+bool
+AuditGhostdagData(const Blockchain& blockchain, const GhostdagData& data)
+{
+    if (data.selected_parent == -1)
+    {
+        return data.mergeset_blues.empty() && data.blues_anticone_sizes.empty();
+    }
+
+    int k = blockchain.ghostdag_k;
+    if (static_cast<int>(data.mergeset_blues.size()) > k + 1)
+    {
+        return false;
+    }
+
+    const GhostdagData& parent_data = blockchain.ghostdag_data[data.selected_parent];
+
+    // Blues already in the selected parent's view keep their size there plus one for
+    // every new blue in their anticone; new blues count their whole anticone
+    std::unordered_map<int, int> expected;
+    expected[data.selected_parent] = 0;
+
+    // Pruning strips blues from the data of blocks outside the pruning point's subtree, and
+    // a walk that runs off the pruning point misses pruned blues, so in those cases the
+    // recorded sizes can only be bounded from below
+    bool exact = blockchain.pruned_block_count == 0 ||
+                 blockchain.reachability.IsReachabilityTreeAncestorOf(blockchain.pruning_point,
+                                                                      data.selected_parent) ||
+                 blockchain.pruning_point == data.selected_parent;
+
+    for (size_t i = 1; i < data.mergeset_blues.size(); i++)
+    {
+        int new_blue = data.mergeset_blues[i];
+        int anticone_size = 0;
+
+        // Same walk as CheckBlueCandidate, but over the final blue set of the block
+        const GhostdagData* chain_data = &data;
+        int chain_block = -1;
+        while (chain_data)
+        {
+            if (chain_block != -1 && blockchain.IsDagAncestorOf(chain_block, new_blue))
+            {
+                break;
+            }
+
+            bool is_new = chain_data == &data;
+            for (int blue_id : chain_data->mergeset_blues)
+            {
+                if (!blockchain.IsInAnticone(blue_id, new_blue))
+                {
+                    continue;
+                }
+
+                anticone_size++;
+                if (is_new && blue_id != data.selected_parent)
+                {
+                    continue;
+                }
+
+                auto it = expected.find(blue_id);
+                if (it == expected.end())
+                {
+                    it = expected.emplace(blue_id, blockchain.BlueAnticoneSize(blue_id, parent_data))
+                             .first;
+                }
+                it->second++;
+            }
+
+            chain_block = chain_data->selected_parent;
+            chain_data = (chain_block == -1) ? nullptr : &blockchain.ghostdag_data[chain_block];
+            if (!chain_data && blockchain.pruned_block_count > 0)
+            {
+                exact = false;
+            }
+        }
+
+        expected[new_blue] = anticone_size;
+    }
+
+    if (exact && expected.size() != data.blues_anticone_sizes.size())
+    {
+        return false;
+    }
+
+    for (const auto& [blue_id, size] : data.blues_anticone_sizes)
+    {
+        if (size > k)
+        {
+            return false;
+        }
+    }
+
+    for (const auto& [blue_id, size] : expected)
+    {
+        auto it = data.blues_anticone_sizes.find(blue_id);
+        if (it == data.blues_anticone_sizes.end())
+        {
+            return false;
+        }
+        if (exact ? it->second != size : it->second < size)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+KClusterAuditResult
+AuditKCluster(const Blockchain& blockchain, unsigned num_threads)
+{
+    if (num_threads == 0)
+    {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    int first_id = blockchain.blocks.GetFirstId();
+    int id_bound = blockchain.blocks.GetIdBound();
+    std::atomic<int> next_id(first_id);
+    std::atomic<int> audited_blocks(0);
+    std::vector<int> violating_blocks;
+    std::mutex violations_mutex;
+
+    auto worker = [&]() {
+        std::vector<int> local_violations;
+        int local_audited = 0;
+
+        while (true)
+        {
+            int chunk_start = next_id.fetch_add(AUDIT_CHUNK_SIZE);
+            if (chunk_start >= id_bound)
+            {
+                break;
+            }
+
+            int chunk_end = std::min(id_bound, chunk_start + AUDIT_CHUNK_SIZE);
+            for (int block_id = chunk_start; block_id < chunk_end; block_id++)
+            {
+                if (!blockchain.blocks.Has(block_id))
+                {
+                    continue;
+                }
+
+                local_audited++;
+                if (!AuditGhostdagData(blockchain, blockchain.ghostdag_data[block_id]))
+                {
+                    local_violations.push_back(block_id);
+                }
+            }
+        }
+
+        audited_blocks += local_audited;
+        std::lock_guard<std::mutex> lock(violations_mutex);
+        violating_blocks.insert(violating_blocks.end(),
+                                local_violations.begin(),
+                                local_violations.end());
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < num_threads; i++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers)
+    {
+        thread.join();
+    }
+
+    KClusterAuditResult result;
+    result.audited_blocks = audited_blocks;
+    result.violating_blocks = std::move(violating_blocks);
+    std::sort(result.violating_blocks.begin(), result.violating_blocks.end());
+
+    // The virtual block carries the blue set of the whole DAG
+    result.audited_blocks++;
+    if (!AuditGhostdagData(blockchain, blockchain.GetVirtualData()))
+    {
+        result.violating_blocks.insert(result.violating_blocks.begin(), -1);
+    }
+
+    return result;
+}
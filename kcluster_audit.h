@@ -0,0 +1,30 @@
+#pragma once
+
+#include "dag.h"
+
+#include <vector>
+
+struct KClusterAuditResult
+{
+    int audited_blocks;
+    std::vector<int> violating_blocks; // -1 stands for the virtual block
+
+    KClusterAuditResult()
+        : audited_blocks(0)
+    {
+    }
+
+    bool Passed() const
+    {
+        return violating_blocks.empty();
+    }
+};
+
+// Checks the GHOSTDAG data of every stored block, and of the virtual block, against
+// reachability: each mergeset has at most k + 1 blues and the recorded blue anticone
+// sizes are exact and at most k. Since every block only extends the data of its selected
+// parent, this proves the blue set of each block, and of the whole DAG, is a k-cluster.
+// Blocks are audited independently on num_threads workers (0 = hardware concurrency).
+KClusterAuditResult AuditKCluster(const Blockchain& blockchain, unsigned num_threads = 0);
+
+bool AuditGhostdagData(const Blockchain& blockchain, const GhostdagData& data);
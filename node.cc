@@ -1,15 +1,20 @@
 #include "node.h"
 
+#include "kcluster_audit.h"
+
 #include "ns3/address.h"
 #include "ns3/boolean.h"
 #include "ns3/double.h"
+#include "ns3/ipv4.h"
 #include "ns3/nstime.h"
+#include "ns3/rng-seed-manager.h"
 #include "ns3/simulator.h"
 #include "ns3/tcp-socket-factory.h"
 #include "ns3/uinteger.h"
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 
 namespace ns3
 {
@@ -18,6 +23,38 @@ NS_LOG_COMPONENT_DEFINE("GhostDagNode");
 
 NS_OBJECT_ENSURE_REGISTERED(GhostDagNode);
 
+namespace
+{
+// Block ids are unique across every node of the simulation; 0 is the shared genesis.
+// Each process of a distributed run takes every g_id_stride-th id.
+int g_next_mined_block_id = 1;
+int g_next_transaction_id = 0;
+int g_id_stride = 1;
+
+// Expected share of the smaller set missing from the other, Erlay's q
+const double RECONCILIATION_Q = 0.25;
+
+// Most ids a single trickled announcement carries, the rest wait for the next one
+const size_t MAX_INV_BATCH = 1000;
+
+// IBD limits: headers per BLOCK_HEADERS, how far past the first missing body downloads
+// may run, and body requests outstanding per peer
+const int MAX_HEADERS_PER_BATCH = 2000;
+const int BLOCK_DOWNLOAD_WINDOW = 1024;
+const int MAX_BLOCKS_IN_FLIGHT_PER_PEER = 16;
+
+// Round trip assumed for a peer not yet measured, and the weight of a new sample in the
+// smoothed one (as TCP's SRTT)
+const double DEFAULT_PEER_RTT = 0.1;
+const double RTT_SMOOTHING = 0.125;
+
+// Announcers expected within this many seconds of the fastest peer are asked at once
+const double RELAY_ESTIMATE_SLACK = 0.001;
+
+// ADDRESSES replies carry a random 23% of the known addresses, as Bitcoin's getaddr
+const size_t ADDRESS_REPLY_PERCENT = 23;
+} // namespace
+
 TypeId
 GhostDagNode::GetTypeId()
 {
@@ -31,6 +68,17 @@ GhostDagNode::GetTypeId()
                           UintegerValue(10),
                           MakeUintegerAccessor(&GhostDagNode::m_ghostdag_k),
                           MakeUintegerChecker<uint8_t>())
+            .AddAttribute("PruningDepth",
+                          "Blue score depth below the selected tip at which the DAG is pruned, "
+                          "0 disables pruning",
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&GhostDagNode::m_pruning_depth),
+                          MakeUintegerChecker<uint32_t>())
+            .AddAttribute("AuditKCluster",
+                          "Whether to audit the k-cluster property of the DAG when stopping.",
+                          BooleanValue(false),
+                          MakeBooleanAccessor(&GhostDagNode::m_audit_kcluster),
+                          MakeBooleanChecker())
             .AddAttribute("Local",
                           "The Address on which to Bind the rx socket.",
                           AddressValue(),
@@ -46,16 +94,104 @@ GhostDagNode::GetTypeId()
                           BooleanValue(false),
                           MakeBooleanAccessor(&GhostDagNode::m_mine_not_synced),
                           MakeBooleanChecker())
+            .AddAttribute("BlockInterval",
+                          "Mean time between blocks mined by this node.",
+                          TimeValue(Seconds(10)),
+                          MakeTimeAccessor(&GhostDagNode::m_block_interval),
+                          MakeTimeChecker())
+            .AddAttribute("MaxBlockSize",
+                          "The max size in bytes of a mined block.",
+                          UintegerValue(500000),
+                          MakeUintegerAccessor(&GhostDagNode::m_max_block_size),
+                          MakeUintegerChecker<uint32_t>())
+            .AddAttribute("TransactionInterval",
+                          "Mean time between transactions created by this node, 0 disables "
+                          "them.",
+                          TimeValue(Seconds(0)),
+                          MakeTimeAccessor(&GhostDagNode::m_transaction_interval),
+                          MakeTimeChecker())
+            .AddAttribute("TxReconciliation",
+                          "Whether to flood transactions to a few peers only and reconcile "
+                          "with the others.",
+                          BooleanValue(false),
+                          MakeBooleanAccessor(&GhostDagNode::m_tx_reconciliation),
+                          MakeBooleanChecker())
+            .AddAttribute("TxFloodPeers",
+                          "The number of peers transactions are still flooded to when "
+                          "reconciling.",
+                          UintegerValue(8),
+                          MakeUintegerAccessor(&GhostDagNode::m_tx_flood_peers),
+                          MakeUintegerChecker<uint32_t>())
+            .AddAttribute("ReconciliationInterval",
+                          "Time between reconciliations, each with the next peer in turn.",
+                          TimeValue(Seconds(1)),
+                          MakeTimeAccessor(&GhostDagNode::m_reconciliation_interval),
+                          MakeTimeChecker())
+            .AddAttribute("TrickleInterval",
+                          "Mean time between transaction announcements to a peer, 0 sends "
+                          "each one at once.",
+                          TimeValue(MilliSeconds(500)),
+                          MakeTimeAccessor(&GhostDagNode::m_trickle_interval),
+                          MakeTimeChecker())
+            .AddAttribute("TransactionRequestTimeout",
+                          "Time to wait for a requested transaction before asking another "
+                          "peer that announced it.",
+                          TimeValue(Seconds(60)),
+                          MakeTimeAccessor(&GhostDagNode::m_tx_request_timeout),
+                          MakeTimeChecker())
+            .AddAttribute("IbdBlueScoreGap",
+                          "How far a peer's blue score must be ahead for a headers-first sync.",
+                          UintegerValue(50),
+                          MakeUintegerAccessor(&GhostDagNode::m_ibd_blue_score_gap),
+                          MakeUintegerChecker<uint32_t>())
+            .AddAttribute("SyncStallTimeout",
+                          "Time without delivering a requested body after which a peer is "
+                          "considered stalling.",
+                          TimeValue(Seconds(10)),
+                          MakeTimeAccessor(&GhostDagNode::m_sync_stall_timeout),
+                          MakeTimeChecker())
+            .AddAttribute("CompactBlocks",
+                          "Whether to relay blocks as a header plus transaction ids.",
+                          BooleanValue(true),
+                          MakeBooleanAccessor(&GhostDagNode::m_compact_blocks),
+                          MakeBooleanChecker())
+            .AddAttribute("SerializationDelay",
+                          "Whether messages leave one at a time at the node's upload speed.",
+                          BooleanValue(false),
+                          MakeBooleanAccessor(&GhostDagNode::m_serialization_delay),
+                          MakeBooleanChecker())
+            .AddAttribute("MaxRelayWait",
+                          "Longest wait for a faster peer to announce a block before "
+                          "requesting it from a slow one.",
+                          TimeValue(MilliSeconds(50)),
+                          MakeTimeAccessor(&GhostDagNode::m_max_relay_wait),
+                          MakeTimeChecker())
             .AddAttribute("InvTimeoutMinutes",
                           "The timeout of inv messages in minutes",
                           TimeValue(Minutes(20)),
                           MakeTimeAccessor(&GhostDagNode::m_inv_timeout_minutes),
                           MakeTimeChecker())
+            .AddAttribute("InvTimeoutTick",
+                          "The resolution of inv timeouts, which all expire on one periodic "
+                          "tick.",
+                          TimeValue(Seconds(1)),
+                          MakeTimeAccessor(&GhostDagNode::m_inv_tick),
+                          MakeTimeChecker(MilliSeconds(1)))
             .AddAttribute("MaxPeers",
                           "The max numbers of peers a node should have discovering",
                           UintegerValue(32),
                           MakeUintegerAccessor(&GhostDagNode::m_max_peers),
                           MakeUintegerChecker<uint8_t>())
+            .AddAttribute("AddressGroupBits",
+                          "Prefix length of the address groups one operator is assumed to run",
+                          UintegerValue(16),
+                          MakeUintegerAccessor(&GhostDagNode::m_address_group_bits),
+                          MakeUintegerChecker<uint32_t>(8, 32))
+            .AddAttribute("AddressTableSize",
+                          "Number of peer addresses the address tables are sized for",
+                          UintegerValue(1024),
+                          MakeUintegerAccessor(&GhostDagNode::m_address_table_size),
+                          MakeUintegerChecker<uint32_t>())
             .AddAttribute("DownloadSpeed",
                           "The download speed of the node in Bytes/s.",
                           DoubleValue(1000000.0),
@@ -76,19 +212,37 @@ GhostDagNode::GetTypeId()
 GhostDagNode::GhostDagNode()
     : m_is_miner(false),
       m_mine_not_synced(false),
+      m_audit_kcluster(false),
+      m_compact_blocks(true),
+      m_max_block_size(500000),
+      m_tx_reconciliation(false),
+      m_tx_flood_peers(8),
+      m_ibd_blue_score_gap(50),
+      m_sync_start_time(0),
+      m_last_headers_time(0),
+      m_serialization_delay(false),
+      m_upload_free_at(0),
+      m_relay_block_bytes(0),
       m_average_transaction_size(522.4),
-      m_transaction_index_size(2)
+      m_transaction_index_size(2),
+      m_address_group_bits(16),
+      m_address_table_size(1024)
 {
     NS_LOG_FUNCTION(this);
     m_socket = nullptr;
+    m_node_stats = nullptr;
+    m_node_state = STANDBY;
     m_mean_block_receive_time = 0;
     m_previous_block_receive_time = 0;
     m_mean_block_propagation_time = 0;
     m_mean_block_size = 0;
+    m_mean_mempool_similarity = 0;
+    m_mempool_similarity_samples = 0;
     m_max_peers = 32;
 
     m_ghostdag_port = 16443;
     m_ghostdag_k = 10;
+    m_pruning_depth = 0;
     m_seconds_per_min = 60;
     m_count_bytes = 4;
     m_message_header_size = 90;
@@ -116,14 +270,17 @@ std::vector<Ipv4Address>
 GhostDagNode::GetPeersAddresses() const
 {
     NS_LOG_FUNCTION(this);
-    return m_peers_addresses;
+    return m_address_manager.GetAddresses();
 }
 
 void
 GhostDagNode::SetPeersAddresses(const std::vector<Ipv4Address>& peers)
 {
     NS_LOG_FUNCTION(this);
-    m_peers_addresses = peers;
+    for (const Ipv4Address& ip : peers)
+    {
+        m_address_manager.Add(ip, ip);
+    }
 }
 
 void
@@ -148,6 +305,14 @@ GhostDagNode::SetNodeInternetSpeeds(const NodeInternetSpeeds& internet_speeds)
     m_upload_speed = internet_speeds.upload_speed * 1000000 / 8;
 }
 
+void
+GhostDagNode::SetIdPartition(uint32_t partition, uint32_t partition_count)
+{
+    g_next_mined_block_id = 1 + static_cast<int>(partition);
+    g_next_transaction_id = static_cast<int>(partition);
+    g_id_stride = static_cast<int>(partition_count);
+}
+
 void
 GhostDagNode::SetNodeStats(NodeStats* node_stats)
 {
@@ -155,6 +320,49 @@ GhostDagNode::SetNodeStats(NodeStats* node_stats)
     m_node_stats = node_stats;
 }
 
+const NodeStats*
+GhostDagNode::GetNodeStats() const
+{
+    return m_node_stats;
+}
+
+bool
+GhostDagNode::UpdateNodeStats()
+{
+    if (!m_node_stats || m_node_state == STANDBY)
+    {
+        return false;
+    }
+
+    m_node_stats->mean_block_receive_time = m_mean_block_receive_time;
+    m_node_stats->mean_block_propagation_time = m_mean_block_propagation_time;
+    m_node_stats->total_blocks = m_blockchain.GetTotalBlockCount();
+    m_node_stats->mean_block_size = m_mean_block_size;
+    m_node_stats->mempool_similarity_score = m_mean_mempool_similarity;
+    m_node_stats->connections = m_peers_sockets.size();
+    m_node_stats->dag_width = m_blockchain.GetDagWidth();
+
+    std::vector<int> ordering = m_blockchain.ComputeGHOSTDAGOrdering();
+    int red_blocks = static_cast<int>(std::count_if(ordering.begin(),
+                                                    ordering.end(),
+                                                    [this](int block_id) {
+                                                        return m_blockchain.IsRed(block_id);
+                                                    }));
+    m_node_stats->red_blocks = red_blocks;
+    m_node_stats->blue_blocks = static_cast<int>(ordering.size()) - red_blocks;
+    m_node_stats->orphan_rate =
+        ordering.empty() ? 0 : static_cast<double>(red_blocks) / ordering.size();
+
+    int mined = static_cast<int>(m_send_block_times.size());
+    m_node_stats->miner_generated_blocks = mined;
+    if (mined > 1)
+    {
+        m_node_stats->miner_average_block_gen_interval =
+            (m_send_block_times.back() - m_send_block_times.front()) / (mined - 1);
+    }
+    return true;
+}
+
 // ============================================================================
 // Application Lifecycle
 // ============================================================================
@@ -179,7 +387,16 @@ GhostDagNode::StartApplication()
     NS_LOG_INFO("Node " << GetNode()->GetId() << ": upload speed = " << m_upload_speed << " B/s");
     NS_LOG_INFO("Node " << GetNode()->GetId()
                         << ": GHOSTDAG K = " << static_cast<int>(m_ghostdag_k));
-    NS_LOG_INFO("Node " << GetNode()->GetId() << ": peers count = " << m_peers_addresses.size());
+    NS_LOG_INFO("Node " << GetNode()->GetId() << ": pruning depth = " << m_pruning_depth);
+    NS_LOG_INFO("Node " << GetNode()->GetId()
+                        << ": known addresses = " << m_address_manager.GetSize());
+
+    m_blockchain.pruning_depth = static_cast<int>(m_pruning_depth);
+    m_node_state = READY;
+    // Replications of a run (RngRun) bucket and sample addresses differently
+    m_address_manager.Configure(static_cast<int>(m_address_group_bits), m_address_table_size);
+    m_address_manager.SetSeed(GetNode()->GetId() ^
+                              static_cast<uint32_t>(RngSeedManager::GetRun() << 16));
 
     if (!m_socket)
     {
@@ -195,11 +412,7 @@ GhostDagNode::StartApplication()
                                 MakeCallback(&GhostDagNode::HandlePeerError, this));
 
     NS_LOG_DEBUG("Node " << GetNode()->GetId() << ": Creating peer sockets");
-    for (const auto& peer_addr : m_peers_addresses)
-    {
-        m_peers_sockets[peer_addr] = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
-        m_peers_sockets[peer_addr]->Connect(InetSocketAddress(peer_addr, m_ghostdag_port));
-    }
+    ConnectToKnownPeers();
 
     if (m_node_stats)
     {
@@ -207,7 +420,45 @@ GhostDagNode::StartApplication()
         m_node_stats->mean_block_receive_time = 0;
         m_node_stats->mean_block_propagation_time = 0;
         m_node_stats->total_blocks = 0;
-        m_node_stats->connections = m_peers_addresses.size();
+        m_node_stats->connections = m_peers_sockets.size();
+        m_node_stats->inv_received_bytes = 0;
+        m_node_stats->inv_sent_bytes = 0;
+        m_node_stats->get_headers_received_bytes = 0;
+        m_node_stats->get_headers_sent_bytes = 0;
+        m_node_stats->headers_received_bytes = 0;
+        m_node_stats->headers_sent_bytes = 0;
+        m_node_stats->get_data_received_bytes = 0;
+        m_node_stats->get_data_sent_bytes = 0;
+        m_node_stats->block_received_bytes = 0;
+        m_node_stats->block_sent_bytes = 0;
+        m_node_stats->block_timeouts = 0;
+        m_node_stats->is_miner = m_is_miner;
+        m_node_stats->miner_generated_blocks = 0;
+        m_node_stats->miner_average_block_gen_interval = 0;
+        m_node_stats->miner_average_block_size = 0;
+        m_node_stats->max_dag_width_seen = 1;
+        m_node_stats->dag_width = 1;
+        m_node_stats->mempool_similarity_score = 0;
+    }
+
+    if (m_is_miner)
+    {
+        m_block_interval_rng = CreateObject<ExponentialRandomVariable>();
+        ScheduleNextBlock();
+    }
+
+    if (!m_transaction_interval.IsZero())
+    {
+        m_transaction_interval_rng = CreateObject<ExponentialRandomVariable>();
+        ScheduleNextTransaction();
+    }
+
+    m_trickle_rng = CreateObject<ExponentialRandomVariable>();
+
+    if (m_tx_reconciliation)
+    {
+        m_reconciliation_event =
+            Simulator::Schedule(m_reconciliation_interval, &GhostDagNode::ReconcileNextPeer, this);
     }
 
     m_discoveryEvent = Simulator::Schedule(Seconds(3.0), &GhostDagNode::DiscoverPeers, this);
@@ -230,7 +481,8 @@ GhostDagNode::PingPeers()
     {
         Address addr;
         kv.second->GetPeerName(addr);
-        SendMessage(PING, "", addr);
+        m_ping_times[kv.first] = Simulator::Now().GetSeconds();
+        SendMessage(GhostDagMessage(PING), addr);
     }
 
     // Repeat every 5 seconds
@@ -245,11 +497,49 @@ GhostDagNode::StopApplication()
     {
         Simulator::Cancel(m_discoveryEvent);
     }
+    if (m_mining_event.IsPending())
+    {
+        Simulator::Cancel(m_mining_event);
+    }
+    if (m_transaction_event.IsPending())
+    {
+        Simulator::Cancel(m_transaction_event);
+    }
+    if (m_reconciliation_event.IsPending())
+    {
+        Simulator::Cancel(m_reconciliation_event);
+    }
+    if (m_sync_event.IsPending())
+    {
+        Simulator::Cancel(m_sync_event);
+    }
+    if (m_tx_request_event.IsPending())
+    {
+        Simulator::Cancel(m_tx_request_event);
+    }
+    m_tx_requests.clear();
+    m_tx_request_deadlines.clear();
+    if (m_inv_tick_event.IsPending())
+    {
+        Simulator::Cancel(m_inv_tick_event);
+    }
+    for (auto& [ip, queue] : m_inventory_queues)
+    {
+        Simulator::Cancel(queue.block_flush);
+        Simulator::Cancel(queue.tx_flush);
+    }
+    m_inventory_queues.clear();
+    for (auto& [block_id, decision] : m_relay_decisions)
+    {
+        Simulator::Cancel(decision);
+    }
+    m_relay_decisions.clear();
 
     for (auto& socket_pair : m_peers_sockets)
     {
         socket_pair.second->Close();
     }
+    m_buffered_data.clear();
 
     if (m_socket)
     {
@@ -258,40 +548,54 @@ GhostDagNode::StopApplication()
     }
 
     NS_LOG_WARN("\n\nGHOSTDAG NODE " << GetNode()->GetId() << ":");
-    NS_LOG_WARN("Total Blocks in DAG = " << m_blockchain.blocks.size());
+    NS_LOG_WARN("Total Blocks in DAG = " << m_blockchain.GetTotalBlockCount());
     NS_LOG_WARN("Mean Block Receive Time = " << m_mean_block_receive_time << "s");
     NS_LOG_WARN("Mean Block Propagation Time = " << m_mean_block_propagation_time << "s");
     NS_LOG_WARN("Mean Block Size = " << m_mean_block_size << " Bytes");
 
-    // Update final stats
-    if (m_node_stats)
+    if (m_audit_kcluster)
     {
-        m_node_stats->mean_block_receive_time = m_mean_block_receive_time;
-        m_node_stats->mean_block_propagation_time = m_mean_block_propagation_time;
-        m_node_stats->total_blocks = m_blockchain.blocks.size();
+        KClusterAuditResult audit = AuditKCluster(m_blockchain);
+        NS_LOG_WARN("K-cluster audit: " << audit.audited_blocks << " blocks, "
+                                        << audit.violating_blocks.size() << " violations");
     }
+
+    // Update final stats
+    UpdateNodeStats();
 }
 
 void
-GhostDagNode::SendMessage(enum Messages type, std::string payload, Address& to)
+GhostDagNode::SendMessage(const GhostDagMessage& message, Address& to)
 {
-    std::ostringstream oss;
-    oss << static_cast<uint8_t>(type) << payload;
-    std::string data = oss.str();
-
-    Ptr<Packet> packet = Create<Packet>((uint8_t*)data.c_str(), data.size());
+    Ptr<Packet> packet = CreateMessagePacket(message);
+    RecordMessageBytes(message.type, packet->GetSize(), true);
 
     InetSocketAddress peer = InetSocketAddress::ConvertFrom(to);
     Ipv4Address ip = peer.GetIpv4();
     auto it = m_peers_sockets.find(ip);
+    Ptr<Socket> socket = it == m_peers_sockets.end() ? OpenPeerSocket(ip) : it->second;
 
-    if (it == m_peers_sockets.end())
+    if (!m_serialization_delay || m_upload_speed <= 0)
     {
-        m_peers_sockets[ip] = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
-        m_peers_sockets[ip]->Connect(InetSocketAddress(ip, m_ghostdag_port));
+        socket->Send(packet);
+        return;
     }
 
-    m_peers_sockets[ip]->Send(packet);
+    // The uplink serializes one message after the other, so a large block delays
+    // everything queued behind it
+    double now = Simulator::Now().GetSeconds();
+    m_upload_free_at = std::max(now, m_upload_free_at) + packet->GetSize() / m_upload_speed;
+    Simulator::Schedule(Seconds(m_upload_free_at - now),
+                        &GhostDagNode::SendPacket,
+                        this,
+                        socket,
+                        packet);
+}
+
+void
+GhostDagNode::SendPacket(Ptr<Socket> socket, Ptr<Packet> packet)
+{
+    socket->Send(packet);
 }
 
 void
@@ -305,89 +609,220 @@ GhostDagNode::HandleRead(Ptr<Socket> socket)
         NS_LOG_INFO("RECEIVED PACKET FROM " << from);
         m_rx_trace(packet, from);
 
-        uint32_t size = packet->GetSize();
-        std::vector<uint8_t> buffer(size);
-        packet->CopyData(buffer.data(), size);
+        // TCP merges and splits messages freely, so bytes are collected per connection
+        // until a whole frame is in
+        StreamBuffer& stream = m_buffered_data[socket];
+        stream.Append(packet);
+
+        uint32_t frame_size;
+        FrameStatus status;
+        while ((status = stream.NextFrame(m_received_message, frame_size)) == FRAME_DECODED)
+        {
+            RecordMessageBytes(m_received_message.type, frame_size, false);
+            if (m_received_message.type == BLOCK || m_received_message.type == COMPACT_BLOCK)
+            {
+                m_relay_block_bytes = m_relay_block_bytes == 0
+                                          ? frame_size
+                                          : 0.9 * m_relay_block_bytes + 0.1 * frame_size;
+            }
+            ProcessMessage(m_received_message, from);
+        }
+
+        if (status == FRAME_MALFORMED)
+        {
+            NS_LOG_WARN("Node " << GetNode()->GetId() << " corrupt stream from " << from
+                                << ", closing");
+            m_buffered_data.erase(socket);
+            socket->Close();
+            return;
+        }
+    }
+}
+
+void
+GhostDagNode::RecordMessageBytes(Messages type, uint32_t bytes, bool sent)
+{
+    if (!m_node_stats)
+    {
+        return;
+    }
 
-        auto msg_type = static_cast<Messages>(buffer[0]);
-        std::string payload(buffer.begin() + 1, buffer.end());
+    long* counter = nullptr;
+    switch (type)
+    {
+    case INV_RELAY_BLOCK:
+    case INV_TRANSACTIONS:
+    case REQ_RECONCILIATION:
+    case RECONCILIATION_SKETCH:
+    case RECONCILIATION_DIFF:
+        counter = sent ? &m_node_stats->inv_sent_bytes : &m_node_stats->inv_received_bytes;
+        break;
+    case REQ_HEADERS:
+    case REQ_BLOCK_LOCATOR:
+        counter = sent ? &m_node_stats->get_headers_sent_bytes
+                       : &m_node_stats->get_headers_received_bytes;
+        break;
+    case BLOCK_HEADERS:
+    case BLOCK_LOCATOR:
+    case IDB_BLOCK_LOCATOR:
+        counter = sent ? &m_node_stats->headers_sent_bytes : &m_node_stats->headers_received_bytes;
+        break;
+    case REQ_RELAY_BLOCK:
+    case REQ_BLOCK_BODIES:
+    case REQ_IDB_BLOCKS:
+    case REQ_TRANSACTIONS:
+    case REQ_ANTIPAST:
+    case REQ_BLOCK_TRANSACTIONS:
+        counter =
+            sent ? &m_node_stats->get_data_sent_bytes : &m_node_stats->get_data_received_bytes;
+        break;
+    case BLOCK:
+    case IDB_BLOCK:
+    case BLOCK_BODY:
+    case COMPACT_BLOCK:
+    case BLOCK_TRANSACTIONS:
+        counter = sent ? &m_node_stats->block_sent_bytes : &m_node_stats->block_received_bytes;
+        break;
+    default:
+        break;
+    }
 
-        NS_LOG_INFO(payload << " " << msg_type);
-        ProcessMessage(msg_type, payload, from);
+    if (counter)
+    {
+        *counter += bytes;
     }
 }
 
 void
-GhostDagNode::ProcessMessage(enum Messages msg_type, std::string payload, Address& from)
+GhostDagNode::ProcessMessage(const GhostDagMessage& message, Address& from)
 {
-    switch (msg_type)
+    switch (message.type)
     {
-    case PING:
+    case PING: {
         NS_LOG_INFO("Node " << GetNode()->GetId() << " <- PING → PONG");
-        SendMessage(PONG, "", from);
+        GhostDagMessage pong(PONG);
+        pong.ids.push_back(m_blockchain.GetVirtualBlueScore());
+        pong.ids.push_back(static_cast<int>(m_upload_speed));
+        SendMessage(pong, from);
         break;
+    }
 
     case PONG:
         NS_LOG_INFO("Node " << GetNode()->GetId() << " <- PONG");
+        HandlePong(message.ids, from);
         break;
 
     case REQ_ADDRESSES: {
-        std::ostringstream oss;
-        int sent = 0;
-
-        for (auto& ip : m_peers_addresses)
-        {
-            if (sent >= m_max_peers)
-            {
-                break;
-            }
-            oss << ip << ",";
-            sent++;
-        }
+        GhostDagMessage reply(ADDRESSES);
+        size_t count = std::max(static_cast<size_t>(m_max_peers),
+                                m_address_manager.GetSize() * ADDRESS_REPLY_PERCENT / 100);
+        reply.addresses = m_address_manager.Sample(std::min(count, MAX_ADDRESSES_PER_MESSAGE));
 
-        NS_LOG_INFO("Node " << GetNode()->GetId() << " sending " << sent << " addresses");
+        NS_LOG_INFO("Node " << GetNode()->GetId() << " sending " << reply.addresses.size()
+                            << " addresses");
 
-        SendMessage(ADDRESSES, oss.str(), from);
+        SendMessage(reply, from);
         break;
     }
 
     case ADDRESSES: {
-        std::stringstream ss(payload);
-        std::string ipStr;
         NS_LOG_INFO("received address " << m_local << " from " << from);
 
-        while (std::getline(ss, ipStr, ','))
+        Ipv4Address source = InetSocketAddress::ConvertFrom(from).GetIpv4();
+        for (const Ipv4Address& ip : message.addresses)
         {
-            if (ipStr.empty())
+            if (!IsLocalAddress(ip) && m_address_manager.Add(ip, source))
             {
-                continue;
+                NS_LOG_INFO("Node " << GetNode()->GetId() << " discovered new peer " << ip);
             }
+        }
 
-            if ((int)m_peers_addresses.size() >= m_max_peers)
-            {
-                break;
-            }
+        ConnectToKnownPeers();
+        break;
+    }
 
-            Ipv4Address ip(ipStr.c_str());
+    case INV_RELAY_BLOCK:
+        HandleInvRelayBlock(message.ids, from);
+        break;
 
-            if (m_peers_sockets.count(ip))
-            {
-                continue;
-            }
+    case REQ_RELAY_BLOCK:
+        HandleReqRelayBlock(message.ids, from);
+        break;
 
-            if (std::find(m_peers_addresses.begin(), m_peers_addresses.end(), ip) !=
-                m_peers_addresses.end())
-            {
-                continue;
-            }
+    case BLOCK:
+        HandleBlock(message.block, from);
+        break;
+
+    case COMPACT_BLOCK:
+        HandleCompactBlock(message, from);
+        break;
+
+    case REQ_BLOCK_TRANSACTIONS:
+        HandleReqBlockTransactions(message.ids, from);
+        break;
+
+    case BLOCK_TRANSACTIONS:
+        HandleBlockTransactions(message.block, from);
+        break;
+
+    case INV_TRANSACTIONS:
+        HandleInvTransactions(message.ids, from);
+        break;
 
-            NS_LOG_INFO("Node " << GetNode()->GetId() << " discovered new peer " << ip);
+    case REQ_TRANSACTIONS:
+        HandleReqTransactions(message.ids, from);
+        break;
 
-            m_peers_addresses.push_back(ip);
-            ConnectToPeer(ip, m_ghostdag_port);
+    case TRANSACTION:
+        for (const Transaction& tx : message.transactions)
+        {
+            HandleTransaction(tx, from);
         }
         break;
-    }
+
+    case REQ_HEADERS:
+        HandleReqHeaders(message.ids, from);
+        break;
+
+    case BLOCK_HEADERS:
+        HandleBlockHeaders(message.headers, from);
+        break;
+
+    case REQ_BLOCK_BODIES:
+        HandleReqBlockBodies(message.ids, from);
+        break;
+
+    case BLOCK_BODY:
+        HandleBlockBody(message.block, from);
+        break;
+
+    case REQ_BLOCK_LOCATOR:
+        HandleReqBlockLocator(message.ids, from);
+        break;
+
+    case BLOCK_LOCATOR:
+        HandleBlockLocator(message.ids, from);
+        break;
+
+    case REQ_ANTIPAST:
+        HandleReqAntipast(message.ids, from);
+        break;
+
+    case IDB_BLOCK:
+        HandleIdbBlock(message.block, from);
+        break;
+
+    case REQ_RECONCILIATION:
+        HandleReqReconciliation(message.ids, from);
+        break;
+
+    case RECONCILIATION_SKETCH:
+        HandleReconciliationSketch(message.sketch, from);
+        break;
+
+    case RECONCILIATION_DIFF:
+        HandleReconciliationDiff(message.ids, from);
+        break;
 
     default:
         break;
@@ -397,7 +832,7 @@ GhostDagNode::ProcessMessage(enum Messages msg_type, std::string payload, Addres
 void
 GhostDagNode::DiscoverPeers()
 {
-    if ((int)m_peers_addresses.size() >= m_max_peers)
+    if ((int)m_peers_sockets.size() >= m_max_peers)
     {
         NS_LOG_INFO("Node " << GetNode()->GetId() << " has max peers, skipping discovery");
         m_discoveryEvent = Simulator::Schedule(Seconds(32), &GhostDagNode::DiscoverPeers, this);
@@ -406,52 +841,156 @@ GhostDagNode::DiscoverPeers()
 
     NS_LOG_INFO("Node " << GetNode()->GetId() << " running peer discovery");
 
-    for (auto& ip : m_peers_addresses)
+    std::vector<Ipv4Address> peers;
+    for (const auto& [ip, socket] : m_peers_sockets)
+    {
+        peers.push_back(ip);
+    }
+    for (const Ipv4Address& ip : peers)
     {
         auto addr = InetSocketAddress(ip, m_ghostdag_port).ConvertTo();
 
-        SendMessage(REQ_ADDRESSES, "", addr);
+        SendMessage(GhostDagMessage(REQ_ADDRESSES), addr);
         NS_LOG_INFO("Node " << GetNode()->GetId() << " sent req address" << " to " << addr);
     }
+    ConnectToKnownPeers();
 
     m_discoveryEvent = Simulator::Schedule(Seconds(5), &GhostDagNode::DiscoverPeers, this);
 }
 
+Ptr<Socket>
+GhostDagNode::OpenPeerSocket(Ipv4Address peerIp)
+{
+    Ptr<Socket> socket = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
+    socket->SetRecvCallback(MakeCallback(&GhostDagNode::HandleRead, this));
+    socket->SetCloseCallbacks(MakeCallback(&GhostDagNode::HandlePeerClose, this),
+                              MakeCallback(&GhostDagNode::HandlePeerError, this));
+    socket->SetConnectCallback(MakeCallback(&GhostDagNode::HandleConnect, this),
+                               MakeCallback(&GhostDagNode::HandlePeerError, this));
+    socket->Connect(InetSocketAddress(peerIp, m_ghostdag_port));
+
+    RegisterPeer(peerIp, socket);
+    return socket;
+}
+
 void
-GhostDagNode::ConnectToPeer(Ipv4Address peerIp, uint16_t port)
+GhostDagNode::HandleConnect(Ptr<Socket> socket)
 {
-    NS_LOG_INFO("CONNECTION TO PEER: " << peerIp);
-    if ((int)m_peers_addresses.size() >= m_max_peers)
+    Address addr;
+    socket->GetPeerName(addr);
+    m_address_manager.Good(InetSocketAddress::ConvertFrom(addr).GetIpv4());
+}
+
+void
+GhostDagNode::ConnectToKnownPeers()
+{
+    // Selection is random and may hit connected peers, so it gets a few tries per slot
+    int wanted = m_max_peers - static_cast<int>(m_peers_sockets.size());
+    for (int tries = 0; wanted > 0 && tries < 4 * m_max_peers; tries++)
     {
-        return;
+        Ipv4Address ip;
+        if (!m_address_manager.Select(ip))
+        {
+            return;
+        }
+        if (m_peers_sockets.count(ip) || IsLocalAddress(ip))
+        {
+            continue;
+        }
+
+        ConnectToPeer(ip, m_ghostdag_port);
+        wanted--;
     }
+}
 
-    if (m_peers_sockets.count(peerIp))
+bool
+GhostDagNode::IsLocalAddress(Ipv4Address ip) const
+{
+    return GetNode()->GetObject<Ipv4>()->GetInterfaceForAddress(ip) >= 0;
+}
+
+void
+GhostDagNode::RegisterPeer(Ipv4Address ip, Ptr<Socket> socket)
+{
+    m_peers_sockets[ip] = socket;
+
+    // The first peers connected keep getting transactions flooded, as outbound peers
+    // do in Erlay
+    if (m_tx_reconciliation && m_flood_peers.size() < m_tx_flood_peers)
     {
-        return;
+        m_flood_peers.insert(ip);
     }
+}
 
-    Ptr<Socket> socket = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
-    socket->SetRecvCallback(MakeCallback(&GhostDagNode::HandleRead, this));
-    socket->SetCloseCallbacks(MakeCallback(&GhostDagNode::HandlePeerClose, this),
-                              MakeCallback(&GhostDagNode::HandlePeerError, this));
+void
+GhostDagNode::UnregisterPeer(Ipv4Address ip)
+{
+    m_peers_sockets.erase(ip);
+    m_peers_download_speeds.erase(ip);
+    m_peers_upload_speeds.erase(ip);
+    m_peer_rtts.erase(ip);
+    m_ping_times.erase(ip);
+    m_flood_peers.erase(ip);
+    m_reconciliation_sets.erase(ip);
+    m_reconciliation_snapshots.erase(ip);
+
+    auto queue = m_inventory_queues.find(ip);
+    if (queue != m_inventory_queues.end())
+    {
+        Simulator::Cancel(queue->second.block_flush);
+        Simulator::Cancel(queue->second.tx_flush);
+        m_inventory_queues.erase(queue);
+    }
+
+    // Bodies requested from the peer go back to the download queue
+    m_peer_blue_scores.erase(ip);
+    m_peer_sync.erase(ip);
+    m_antipast_syncs.erase(ip);
+    for (auto it = m_blocks_in_flight.begin(); it != m_blocks_in_flight.end();)
+    {
+        it = it->second == ip ? m_blocks_in_flight.erase(it) : std::next(it);
+    }
 
-    InetSocketAddress remote(peerIp, m_ghostdag_port);
-    socket->Connect(remote);
+    // Transactions requested from the peer are asked from their next announcer
+    std::vector<int> requested;
+    for (auto& [tx_id, request] : m_tx_requests)
+    {
+        std::vector<Ipv4Address>& announcers = request.announcers;
+        if (announcers.front() == ip)
+        {
+            requested.push_back(tx_id);
+            continue;
+        }
+        announcers.erase(std::remove(announcers.begin(), announcers.end(), ip),
+                         announcers.end());
+    }
+    RequestFromNextAnnouncers(requested);
+}
 
-    m_peers_sockets[peerIp] = socket;
+void
+GhostDagNode::ConnectToPeer(Ipv4Address peerIp, uint16_t port)
+{
+    NS_LOG_INFO("CONNECTION TO PEER: " << peerIp);
+    if ((int)m_peers_sockets.size() >= m_max_peers)
+    {
+        return;
+    }
 
-    if (std::find(m_peers_addresses.begin(), m_peers_addresses.end(), peerIp) ==
-        m_peers_addresses.end())
+    if (m_peers_sockets.count(peerIp))
     {
-        m_peers_addresses.push_back(peerIp);
+        return;
     }
+
+    m_address_manager.Add(peerIp, peerIp);
+    m_address_manager.Attempt(peerIp);
+    OpenPeerSocket(peerIp);
 }
 
 void
 GhostDagNode::HandlePeerClose(Ptr<Socket> socket)
 {
     NS_LOG_FUNCTION(this << socket);
+    m_buffered_data.erase(socket);
 
     for (auto it = m_peers_sockets.begin(); it != m_peers_sockets.end(); ++it)
     {
@@ -460,9 +999,7 @@ GhostDagNode::HandlePeerClose(Ptr<Socket> socket)
             Ipv4Address ip = it->first;
             NS_LOG_INFO("Node " << GetNode()->GetId() << " peer closed: " << ip);
 
-            m_peers_sockets.erase(it);
-            m_peers_download_speeds.erase(ip);
-            m_peers_upload_speeds.erase(ip);
+            UnregisterPeer(ip);
             break;
         }
     }
@@ -472,6 +1009,7 @@ void
 GhostDagNode::HandlePeerError(Ptr<Socket> socket)
 {
     NS_LOG_FUNCTION(this << socket);
+    m_buffered_data.erase(socket);
 
     for (auto it = m_peers_sockets.begin(); it != m_peers_sockets.end(); ++it)
     {
@@ -481,9 +1019,7 @@ GhostDagNode::HandlePeerError(Ptr<Socket> socket)
             NS_LOG_WARN("Node " << GetNode()->GetId() << " peer error: " << ip);
 
             it->second->Close();
-            m_peers_sockets.erase(it);
-            m_peers_download_speeds.erase(ip);
-            m_peers_upload_speeds.erase(ip);
+            UnregisterPeer(ip);
             break;
         }
     }
@@ -495,7 +1031,7 @@ GhostDagNode::HandleAccept(Ptr<Socket> s, const Address& from)
     InetSocketAddress peer = InetSocketAddress::ConvertFrom(from);
     Ipv4Address ip = peer.GetIpv4();
 
-    if ((int)m_peers_addresses.size() >= m_max_peers)
+    if ((int)m_peers_sockets.size() >= m_max_peers)
     {
         s->Close();
         return;
@@ -507,13 +1043,1562 @@ GhostDagNode::HandleAccept(Ptr<Socket> s, const Address& from)
     s->SetCloseCallbacks(MakeCallback(&GhostDagNode::HandlePeerClose, this),
                          MakeCallback(&GhostDagNode::HandlePeerError, this));
 
-    m_peers_sockets[ip] = s;
+    RegisterPeer(ip, s);
+    m_address_manager.Add(ip, ip);
+}
+
+// ============================================================================
+// Mining
+// ============================================================================
+
+void
+GhostDagNode::ScheduleNextBlock()
+{
+    double interval = m_block_interval_rng->GetValue(m_block_interval.GetSeconds(), 0);
+    m_mining_event = Simulator::Schedule(Seconds(interval), &GhostDagNode::MineBlock, this);
+}
+
+void
+GhostDagNode::MineBlock()
+{
+    if (m_node_state == READY || m_mine_not_synced)
+    {
+        Block block;
+        block.header.block_id = g_next_mined_block_id;
+        g_next_mined_block_id += g_id_stride;
+        block.header.miner_id = GetNode()->GetId();
+        block.header.time_created = Simulator::Now().GetSeconds();
+        block.header.parent_hashes = m_blockchain.GetVirtualParents();
+        block.time_received = block.header.time_created;
+
+        int size = block.header.GetSizeInBytes();
+        for (const auto& [tx_id, tx] : m_mempool.pending_txs)
+        {
+            if (size + tx.size_bytes > static_cast<int>(m_max_block_size))
+            {
+                break;
+            }
+            block.transactions.insert(tx);
+            size += tx.size_bytes;
+        }
+        block.size_in_bytes = size;
+
+        NS_LOG_INFO("Node " << GetNode()->GetId() << " mined block " << block.header.block_id
+                            << " with " << block.header.parent_hashes.size() << " parents and "
+                            << block.transactions.size() << " transactions");
+
+        m_send_block_times.push_back(block.header.time_created);
+        if (m_node_stats)
+        {
+            int mined = static_cast<int>(m_send_block_times.size());
+            m_node_stats->miner_average_block_size +=
+                (size - m_node_stats->miner_average_block_size) / mined;
+        }
+
+        ValidateBlock(block);
+    }
+
+    ScheduleNextBlock();
+}
+
+// ============================================================================
+// Block Relay
+// ============================================================================
+
+void
+GhostDagNode::HandleInvRelayBlock(const std::vector<int>& block_ids, Address& from)
+{
+    GhostDagMessage request(REQ_RELAY_BLOCK);
+    Ipv4Address ip = InetSocketAddress::ConvertFrom(from).GetIpv4();
 
-    if (std::find(m_peers_addresses.begin(), m_peers_addresses.end(), ip) ==
-        m_peers_addresses.end())
+    double fastest = EstimateBlockDelivery(ip);
+    for (const auto& [peer, socket] : m_peers_sockets)
     {
-        m_peers_addresses.push_back(ip);
+        fastest = std::min(fastest, EstimateBlockDelivery(peer));
     }
+
+    for (int block_id : block_ids)
+    {
+        if (block_id < m_blockchain.blocks.GetFirstId() || m_blockchain.HasBlock(block_id) ||
+            m_blockchain.IsOrphan(block_id))
+        {
+            continue;
+        }
+
+        // Already announced: the announcer is a candidate while the request waits, and
+        // a fallback if it times out
+        auto it = m_queue_inv.find(block_id);
+        if (it != m_queue_inv.end())
+        {
+            it->second.push_back(from);
+            auto decision = m_relay_decisions.find(block_id);
+            if (decision != m_relay_decisions.end() &&
+                EstimateBlockDelivery(ip) <= fastest + RELAY_ESTIMATE_SLACK)
+            {
+                Simulator::Cancel(decision->second);
+                m_relay_decisions.erase(decision);
+                RequestRelayBlock(block_id);
+            }
+            continue;
+        }
+
+        m_queue_inv[block_id].push_back(from);
+
+        // Waiting for a faster announcer pays off at most by the difference in expected
+        // delivery, half of it is risked
+        double wait = (EstimateBlockDelivery(ip) - fastest) / 2;
+        if (wait <= RELAY_ESTIMATE_SLACK)
+        {
+            ArmInvTimeout(block_id);
+            request.ids.push_back(block_id);
+            continue;
+        }
+
+        m_relay_decisions[block_id] =
+            Simulator::Schedule(std::min(Seconds(wait), m_max_relay_wait),
+                                &GhostDagNode::RequestRelayBlock,
+                                this,
+                                block_id);
+    }
+
+    if (!request.ids.empty())
+    {
+        SendMessage(request, from);
+    }
+}
+
+uint64_t
+GhostDagNode::GetInvTick() const
+{
+    return static_cast<uint64_t>(Simulator::Now().GetTimeStep() / m_inv_tick.GetTimeStep());
+}
+
+void
+GhostDagNode::ArmInvTimeout(int block_id)
+{
+    // The wheel only ticks while requests are outstanding, so an empty one catches up
+    // with the clock first. One holding deadlines is never reset.
+    if (m_inv_timeouts.GetSize() == 0)
+    {
+        m_inv_timeouts.Restart(GetInvTick());
+    }
+
+    uint64_t ticks = (m_inv_timeout_minutes.GetTimeStep() + m_inv_tick.GetTimeStep() - 1) /
+                     m_inv_tick.GetTimeStep();
+    m_inv_timeouts.Schedule(block_id, m_inv_timeouts.GetCurrentTick() + ticks);
+
+    // The running tick event counts as not pending; it reschedules itself once done
+    if (!m_inv_tick_event.IsPending())
+    {
+        m_inv_tick_event =
+            Simulator::Schedule(m_inv_tick, &GhostDagNode::AdvanceInvTimeouts, this);
+    }
+}
+
+void
+GhostDagNode::AdvanceInvTimeouts()
+{
+    std::vector<int> expired;
+    m_inv_timeouts.Advance(GetInvTick(), expired);
+    for (int block_id : expired)
+    {
+        InvTimeoutExpired(block_id);
+    }
+
+    // Expiries may have armed the tick again through ArmInvTimeout; replace that event
+    Simulator::Cancel(m_inv_tick_event);
+    if (m_inv_timeouts.GetSize() > 0)
+    {
+        m_inv_tick_event =
+            Simulator::Schedule(m_inv_tick, &GhostDagNode::AdvanceInvTimeouts, this);
+    }
+}
+
+void
+GhostDagNode::InvTimeoutExpired(int block_id)
+{
+    m_only_headers_received.erase(block_id);
+
+    auto it = m_queue_inv.find(block_id);
+    if (it == m_queue_inv.end())
+    {
+        return;
+    }
+
+    if (m_node_stats)
+    {
+        m_node_stats->block_timeouts++;
+    }
+
+    it->second.erase(it->second.begin());
+    if (it->second.empty())
+    {
+        m_queue_inv.erase(it);
+        return;
+    }
+
+    NS_LOG_INFO("Node " << GetNode()->GetId() << " request for block " << block_id
+                        << " timed out, asking the next peer");
+
+    RequestRelayBlock(block_id);
+}
+
+void
+GhostDagNode::RequestRelayBlock(int block_id)
+{
+    m_relay_decisions.erase(block_id);
+
+    auto it = m_queue_inv.find(block_id);
+    if (it == m_queue_inv.end())
+    {
+        return;
+    }
+
+    // The chosen announcer moves to the front, the others stay as fallbacks
+    std::vector<Address>& announcers = it->second;
+    auto best = announcers.begin();
+    double best_estimate = EstimateBlockDelivery(InetSocketAddress::ConvertFrom(*best).GetIpv4());
+    for (auto candidate = announcers.begin() + 1; candidate != announcers.end(); ++candidate)
+    {
+        double estimate =
+            EstimateBlockDelivery(InetSocketAddress::ConvertFrom(*candidate).GetIpv4());
+        if (estimate < best_estimate)
+        {
+            best = candidate;
+            best_estimate = estimate;
+        }
+    }
+    std::iter_swap(announcers.begin(), best);
+
+    GhostDagMessage request(REQ_RELAY_BLOCK);
+    request.ids.push_back(block_id);
+    SendMessage(request, announcers.front());
+    ArmInvTimeout(block_id);
+}
+
+double
+GhostDagNode::EstimateBlockDelivery(Ipv4Address peer) const
+{
+    // A request's round trip, then the block at the slower of the two ends' speeds
+    auto rtt = m_peer_rtts.find(peer);
+    double delivery = rtt != m_peer_rtts.end() ? rtt->second : DEFAULT_PEER_RTT;
+
+    double rate = m_download_speed;
+    auto upload = m_peers_upload_speeds.find(peer);
+    if (upload != m_peers_upload_speeds.end() && upload->second > 0)
+    {
+        rate = std::min(rate, upload->second);
+    }
+
+    return rate > 0 ? delivery + m_relay_block_bytes / rate : delivery;
+}
+
+void
+GhostDagNode::HandleReqRelayBlock(const std::vector<int>& block_ids, Address& from)
+{
+    for (int block_id : block_ids)
+    {
+        if (m_blockchain.HasBody(block_id))
+        {
+            SendRelayBlock(block_id, from);
+        }
+    }
+}
+
+void
+GhostDagNode::SendRelayBlock(int block_id, Address& to)
+{
+    GhostDagMessage message(m_compact_blocks ? COMPACT_BLOCK : BLOCK);
+    message.block = m_blockchain.GetBlock(block_id);
+
+    // The receiver rebuilds the body from its mempool and asks for whatever it lacks
+    if (m_compact_blocks)
+    {
+        message.ids.reserve(message.block.transactions.size());
+        for (const Transaction& tx : message.block.transactions)
+        {
+            message.ids.push_back(tx.tx_id);
+        }
+        message.block.transactions.clear();
+    }
+
+    SendMessage(message, to);
+}
+
+void
+GhostDagNode::HandleCompactBlock(const GhostDagMessage& message, Address& from)
+{
+    int block_id = message.block.header.block_id;
+    if (m_blockchain.HasBlock(block_id) || m_blockchain.IsOrphan(block_id) ||
+        OnlyHeadersReceived(block_id))
+    {
+        return;
+    }
+
+    Block block;
+    block.header = message.block.header;
+    block.size_in_bytes = message.block.size_in_bytes;
+
+    GhostDagMessage request(REQ_BLOCK_TRANSACTIONS);
+    request.ids.push_back(block_id);
+
+    // Ids come in ascending order, so every insert goes at the end of the set
+    for (int tx_id : message.ids)
+    {
+        auto it = m_mempool.pending_txs.find(tx_id);
+        if (it != m_mempool.pending_txs.end())
+        {
+            block.transactions.insert(block.transactions.end(), it->second);
+        }
+        else
+        {
+            request.ids.push_back(tx_id);
+        }
+    }
+
+    if (request.ids.size() == 1)
+    {
+        HandleBlock(block, from);
+        return;
+    }
+
+    NS_LOG_INFO("Node " << GetNode()->GetId() << " compact block " << block_id << " missing "
+                        << request.ids.size() - 1 << " of " << message.ids.size()
+                        << " transactions");
+
+    m_only_headers_received[block_id] = std::move(block);
+    SendMessage(request, from);
+}
+
+void
+GhostDagNode::HandleReqBlockTransactions(const std::vector<int>& ids, Address& from)
+{
+    if (ids.empty() || !m_blockchain.HasBody(ids[0]))
+    {
+        return;
+    }
+
+    const std::set<Transaction>& block_txs =
+        m_blockchain.blocks.bodies[ids[0]].content->transactions;
+
+    GhostDagMessage reply(BLOCK_TRANSACTIONS);
+    reply.block.header.block_id = ids[0];
+    for (size_t i = 1; i < ids.size(); i++)
+    {
+        auto it = block_txs.find(Transaction{ids[i], 0, 0});
+        if (it != block_txs.end())
+        {
+            reply.block.transactions.insert(reply.block.transactions.end(), *it);
+        }
+    }
+
+    SendMessage(reply, from);
+}
+
+void
+GhostDagNode::HandleBlockTransactions(const Block& body, Address& from)
+{
+    auto it = m_only_headers_received.find(body.header.block_id);
+    if (it == m_only_headers_received.end())
+    {
+        return;
+    }
+
+    Block block = std::move(it->second);
+    m_only_headers_received.erase(it);
+    block.transactions.insert(body.transactions.begin(), body.transactions.end());
+
+    HandleBlock(block, from);
+}
+
+bool
+GhostDagNode::OnlyHeadersReceived(int block_id)
+{
+    return m_only_headers_received.find(block_id) != m_only_headers_received.end();
+}
+
+void
+GhostDagNode::HandleBlock(const Block& new_block, Address& from)
+{
+    int block_id = new_block.header.block_id;
+
+    m_inv_timeouts.Cancel(block_id);
+    auto decision = m_relay_decisions.find(block_id);
+    if (decision != m_relay_decisions.end())
+    {
+        Simulator::Cancel(decision->second);
+        m_relay_decisions.erase(decision);
+    }
+    m_queue_inv.erase(block_id);
+    bool parent_request = m_parent_requests.erase(block_id) > 0;
+
+    double now = Simulator::Now().GetSeconds();
+    Block block = new_block;
+    block.time_received = now;
+    block.received_from = InetSocketAddress::ConvertFrom(from).GetIpv4();
+
+    // Relayed ahead of the IBD download of its body
+    if (m_blockchain.HasBlock(block_id) && !m_blockchain.HasBody(block_id))
+    {
+        StoreBlockBody(block);
+        return;
+    }
+
+    if (m_blockchain.HasBlock(block_id) || m_blockchain.IsOrphan(block_id))
+    {
+        return;
+    }
+
+    m_receive_block_times.push_back(now);
+    int received = static_cast<int>(m_receive_block_times.size());
+    if (received > 1)
+    {
+        m_mean_block_receive_time +=
+            (now - m_previous_block_receive_time - m_mean_block_receive_time) / (received - 1);
+    }
+    m_previous_block_receive_time = now;
+    m_mean_block_propagation_time +=
+        (now - block.header.time_created - m_mean_block_propagation_time) / received;
+    m_mean_block_size += (block.size_in_bytes - m_mean_block_size) / received;
+
+    // Share of the block's transactions that were already in the mempool, which is what
+    // transaction relay has to keep high for blocks to be rebuilt locally
+    if (!block.transactions.empty())
+    {
+        std::set<int> tx_ids;
+        for (const Transaction& tx : block.transactions)
+        {
+            tx_ids.insert(tx_ids.end(), tx.tx_id);
+        }
+        double similarity =
+            static_cast<double>(m_mempool.GetIntersectionSize(tx_ids)) / tx_ids.size();
+        m_mempool_similarity_samples++;
+        m_mean_mempool_similarity +=
+            (similarity - m_mean_mempool_similarity) / m_mempool_similarity_samples;
+    }
+
+    ValidateBlock(block);
+
+    if (m_blockchain.IsOrphan(block_id))
+    {
+        // A fetched parent that is an orphan as well means a gap deeper than one block,
+        // which is cheaper to close in one antipast sync than level by level
+        if (parent_request)
+        {
+            StartAntipastSync(block.received_from);
+        }
+        else
+        {
+            CheckForMissingParents(block, from);
+        }
+    }
+}
+
+void
+GhostDagNode::CheckForMissingParents(const Block& new_block, Address& from)
+{
+    // The sender has every parent, so they are fetched like announced blocks
+    std::vector<int> missing_parents;
+    for (int parent_id : new_block.header.parent_hashes)
+    {
+        if (!m_blockchain.HasBlock(parent_id))
+        {
+            missing_parents.push_back(parent_id);
+            m_parent_requests.insert(parent_id);
+        }
+    }
+    HandleInvRelayBlock(missing_parents, from);
+}
+
+void
+GhostDagNode::ValidateBlock(const Block& new_block)
+{
+    int block_id = new_block.header.block_id;
+    m_blockchain.AddBlock(new_block);
+
+    if (m_blockchain.IsOrphan(block_id))
+    {
+        m_orphan_block_ids.insert(block_id);
+        return;
+    }
+
+    if (!m_blockchain.HasBlock(block_id))
+    {
+        NS_LOG_WARN("Node " << GetNode()->GetId() << " rejected block " << block_id);
+        return;
+    }
+
+    if (m_node_stats)
+    {
+        m_node_stats->max_dag_width_seen =
+            std::max(m_node_stats->max_dag_width_seen, m_blockchain.GetDagWidth());
+    }
+
+    AdvertiseNewBlock(new_block);
+    Unorphan(new_block);
+}
+
+void
+GhostDagNode::Unorphan(const Block& new_block)
+{
+    // Orphans connected by the new block are announced as well
+    for (auto it = m_orphan_block_ids.begin(); it != m_orphan_block_ids.end();)
+    {
+        if (m_blockchain.IsOrphan(*it))
+        {
+            ++it;
+            continue;
+        }
+
+        if (m_blockchain.HasBlock(*it))
+        {
+            AdvertiseNewBlock(m_blockchain.GetBlock(*it));
+        }
+        it = m_orphan_block_ids.erase(it);
+    }
+}
+
+void
+GhostDagNode::AdvertiseNewBlock(const Block& new_block)
+{
+    RemoveConfirmedTransactions(new_block);
+    BroadcastInvBlock(new_block.header.block_id);
+}
+
+void
+GhostDagNode::RemoveConfirmedTransactions(const Block& block)
+{
+    std::set<int> tx_ids;
+    for (const Transaction& tx : block.transactions)
+    {
+        tx_ids.insert(tx_ids.end(), tx.tx_id);
+    }
+    m_mempool.RemoveTransactions(tx_ids);
+    if (tx_ids.empty())
+    {
+        return;
+    }
+
+    for (int tx_id : tx_ids)
+    {
+        m_confirmed_transactions[tx_id]++;
+        m_tx_requests.erase(tx_id);
+    }
+    m_confirming_blocks.emplace_back(block.header.block_id,
+                                     std::vector<int>(tx_ids.begin(), tx_ids.end()));
+
+    // Blocks arrive roughly in pruning order, so the pruned ones are found at the front
+    while (!m_confirming_blocks.empty() &&
+           !m_blockchain.HasBlock(m_confirming_blocks.front().first))
+    {
+        for (int tx_id : m_confirming_blocks.front().second)
+        {
+            auto it = m_confirmed_transactions.find(tx_id);
+            if (--it->second == 0)
+            {
+                m_confirmed_transactions.erase(it);
+            }
+        }
+        m_confirming_blocks.pop_front();
+    }
+}
+
+void
+GhostDagNode::BroadcastInvBlock(int block_id)
+{
+    Ipv4Address source = m_blockchain.blocks.bodies[block_id].received_from;
+
+    for (auto& [ip, socket] : m_peers_sockets)
+    {
+        if (ip == source)
+        {
+            continue;
+        }
+        QueueInventory(ip, INV_RELAY_BLOCK, block_id);
+    }
+}
+
+void
+GhostDagNode::QueueInventory(Ipv4Address peer, Messages type, int id)
+{
+    PeerInventoryQueue& queue = m_inventory_queues[peer];
+
+    if (type == INV_RELAY_BLOCK)
+    {
+        // Blocks skip the trickle; blocks accepted in the same event share one message
+        queue.block_ids.push_back(id);
+        if (!queue.block_flush.IsPending())
+        {
+            queue.block_flush =
+                Simulator::ScheduleNow(&GhostDagNode::FlushBlockInventory, this, peer);
+        }
+        return;
+    }
+
+    queue.tx_ids.push_back(id);
+    if (m_trickle_interval.IsZero())
+    {
+        FlushTransactionInventory(peer);
+        return;
+    }
+    if (!queue.tx_flush.IsPending())
+    {
+        double delay = m_trickle_rng->GetValue(m_trickle_interval.GetSeconds(), 0);
+        queue.tx_flush = Simulator::Schedule(Seconds(delay),
+                                             &GhostDagNode::FlushTransactionInventory,
+                                             this,
+                                             peer);
+    }
+}
+
+void
+GhostDagNode::FlushBlockInventory(Ipv4Address peer)
+{
+    PeerInventoryQueue& queue = m_inventory_queues[peer];
+
+    GhostDagMessage inv(INV_RELAY_BLOCK);
+    inv.ids.swap(queue.block_ids);
+    Address to = InetSocketAddress(peer, m_ghostdag_port);
+    SendMessage(inv, to);
+}
+
+void
+GhostDagNode::FlushTransactionInventory(Ipv4Address peer)
+{
+    PeerInventoryQueue& queue = m_inventory_queues[peer];
+
+    GhostDagMessage inv(INV_TRANSACTIONS);
+    if (queue.tx_ids.size() <= MAX_INV_BATCH)
+    {
+        inv.ids.swap(queue.tx_ids);
+    }
+    else
+    {
+        inv.ids.assign(queue.tx_ids.begin(), queue.tx_ids.begin() + MAX_INV_BATCH);
+        queue.tx_ids.erase(queue.tx_ids.begin(), queue.tx_ids.begin() + MAX_INV_BATCH);
+
+        double delay = m_trickle_rng->GetValue(m_trickle_interval.GetSeconds(), 0);
+        queue.tx_flush = Simulator::Schedule(Seconds(delay),
+                                             &GhostDagNode::FlushTransactionInventory,
+                                             this,
+                                             peer);
+    }
+
+    Address to = InetSocketAddress(peer, m_ghostdag_port);
+    SendMessage(inv, to);
+}
+
+// ============================================================================
+// Transaction Relay
+// ============================================================================
+
+void
+GhostDagNode::ScheduleNextTransaction()
+{
+    double interval = m_transaction_interval_rng->GetValue(m_transaction_interval.GetSeconds(), 0);
+    m_transaction_event =
+        Simulator::Schedule(Seconds(interval), &GhostDagNode::GenerateTransaction, this);
+}
+
+void
+GhostDagNode::GenerateTransaction()
+{
+    Transaction tx;
+    tx.tx_id = g_next_transaction_id;
+    g_next_transaction_id += g_id_stride;
+    tx.arrival_time = Simulator::Now().GetSeconds();
+    tx.size_bytes = static_cast<int>(m_average_transaction_size);
+
+    m_mempool.AddTransaction(tx);
+    BroadcastInvTransaction(tx.tx_id, Ipv4Address());
+
+    ScheduleNextTransaction();
+}
+
+void
+GhostDagNode::BroadcastInvTransaction(int tx_id, Ipv4Address source)
+{
+    for (auto& [ip, socket] : m_peers_sockets)
+    {
+        if (ip == source)
+        {
+            continue;
+        }
+        if (m_tx_reconciliation && !m_flood_peers.count(ip))
+        {
+            m_reconciliation_sets[ip].insert(tx_id);
+            continue;
+        }
+        QueueInventory(ip, INV_TRANSACTIONS, tx_id);
+    }
+}
+
+void
+GhostDagNode::HandleInvTransactions(const std::vector<int>& tx_ids, Address& from)
+{
+    // The announcer has these, so they no longer need reconciling with it
+    Ipv4Address ip = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    auto set = m_reconciliation_sets.find(ip);
+
+    GhostDagMessage request(REQ_TRANSACTIONS);
+    for (int tx_id : tx_ids)
+    {
+        if (set != m_reconciliation_sets.end())
+        {
+            set->second.erase(tx_id);
+        }
+        if (AddTransactionAnnouncer(tx_id, ip))
+        {
+            request.ids.push_back(tx_id);
+        }
+    }
+
+    if (!request.ids.empty())
+    {
+        SendMessage(request, from);
+    }
+}
+
+void
+GhostDagNode::HandleReqTransactions(const std::vector<int>& tx_ids, Address& from)
+{
+    GhostDagMessage reply(TRANSACTION);
+    for (int tx_id : tx_ids)
+    {
+        auto it = m_mempool.pending_txs.find(tx_id);
+        if (it != m_mempool.pending_txs.end())
+        {
+            reply.transactions.push_back(it->second);
+        }
+    }
+
+    if (!reply.transactions.empty())
+    {
+        SendMessage(reply, from);
+    }
+}
+
+void
+GhostDagNode::HandleTransaction(const Transaction& tx, Address& from)
+{
+    m_tx_requests.erase(tx.tx_id);
+    if (IsKnownTransaction(tx.tx_id))
+    {
+        return;
+    }
+
+    Transaction received = tx;
+    received.arrival_time = Simulator::Now().GetSeconds();
+    m_mempool.AddTransaction(received);
+    BroadcastInvTransaction(tx.tx_id, InetSocketAddress::ConvertFrom(from).GetIpv4());
+}
+
+bool
+GhostDagNode::IsKnownTransaction(int tx_id) const
+{
+    return m_mempool.HasTransaction(tx_id) ||
+           m_confirmed_transactions.find(tx_id) != m_confirmed_transactions.end();
+}
+
+bool
+GhostDagNode::AddTransactionAnnouncer(int tx_id, Ipv4Address peer)
+{
+    // True if the transaction is to be requested from peer now; one already requested
+    // elsewhere only gets peer as a fallback
+    if (IsKnownTransaction(tx_id))
+    {
+        return false;
+    }
+
+    auto it = m_tx_requests.find(tx_id);
+    if (it != m_tx_requests.end())
+    {
+        std::vector<Ipv4Address>& announcers = it->second.announcers;
+        if (std::find(announcers.begin(), announcers.end(), peer) == announcers.end())
+        {
+            announcers.push_back(peer);
+        }
+        return false;
+    }
+
+    m_tx_requests[tx_id].announcers.push_back(peer);
+    SetTransactionDeadline(tx_id);
+    return true;
+}
+
+void
+GhostDagNode::SetTransactionDeadline(int tx_id)
+{
+    // The timeout is the same for every request, so deadlines are queued in order
+    Time deadline = Simulator::Now() + m_tx_request_timeout;
+    m_tx_requests[tx_id].deadline = deadline;
+    m_tx_request_deadlines.emplace_back(deadline, tx_id);
+
+    // The running expiry event counts as not pending; it reschedules itself once done
+    if (!m_tx_request_event.IsPending())
+    {
+        m_tx_request_event = Simulator::Schedule(m_tx_request_timeout,
+                                                 &GhostDagNode::ExpireTransactionRequests,
+                                                 this);
+    }
+}
+
+void
+GhostDagNode::ExpireTransactionRequests()
+{
+    Time now = Simulator::Now();
+    std::vector<int> expired;
+    while (!m_tx_request_deadlines.empty() && m_tx_request_deadlines.front().first <= now)
+    {
+        auto [deadline, tx_id] = m_tx_request_deadlines.front();
+        m_tx_request_deadlines.pop_front();
+
+        auto it = m_tx_requests.find(tx_id);
+        if (it != m_tx_requests.end() && it->second.deadline == deadline)
+        {
+            expired.push_back(tx_id);
+        }
+    }
+
+    if (!expired.empty())
+    {
+        NS_LOG_INFO("Node " << GetNode()->GetId() << " " << expired.size()
+                            << " transaction requests timed out, asking the next peers");
+    }
+    RequestFromNextAnnouncers(expired);
+
+    // Re-sent requests may have armed the event again; replace it
+    Simulator::Cancel(m_tx_request_event);
+    if (!m_tx_request_deadlines.empty())
+    {
+        m_tx_request_event = Simulator::Schedule(m_tx_request_deadlines.front().first - now,
+                                                 &GhostDagNode::ExpireTransactionRequests,
+                                                 this);
+    }
+}
+
+void
+GhostDagNode::RequestFromNextAnnouncers(const std::vector<int>& tx_ids)
+{
+    // The peer asked so far is dropped, and what is left is requested in one message per
+    // next announcer
+    std::map<Ipv4Address, GhostDagMessage> requests;
+    for (int tx_id : tx_ids)
+    {
+        auto it = m_tx_requests.find(tx_id);
+        std::vector<Ipv4Address>& announcers = it->second.announcers;
+        announcers.erase(announcers.begin());
+        if (announcers.empty())
+        {
+            m_tx_requests.erase(it);
+            continue;
+        }
+
+        auto request = requests.try_emplace(announcers.front(), REQ_TRANSACTIONS);
+        request.first->second.ids.push_back(tx_id);
+        SetTransactionDeadline(tx_id);
+    }
+
+    for (auto& [peer, request] : requests)
+    {
+        Address to = InetSocketAddress(peer, m_ghostdag_port);
+        SendMessage(request, to);
+    }
+}
+
+// ============================================================================
+// Transaction Reconciliation
+// ============================================================================
+//
+// Every ReconciliationInterval the node reconciles with its next non-flood peer. Both
+// ends of a link initiate in turn, there are no inbound/outbound roles:
+//   1. REQ_RECONCILIATION with the size of the initiator's set for the peer
+//   2. the responder sketches its set for the initiator, sized for the estimated
+//      difference, and holds it as a snapshot
+//   3. the initiator subtracts its own sketch and decodes the symmetric difference, then
+//      sends RECONCILIATION_DIFF requesting what it lacks and announcing what the
+//      responder lacks. If decoding fails it announces its whole set, and the responder
+//      answers by announcing its snapshot.
+
+void
+GhostDagNode::ReconcileNextPeer()
+{
+    m_reconciliation_event =
+        Simulator::Schedule(m_reconciliation_interval, &GhostDagNode::ReconcileNextPeer, this);
+
+    if (m_peers_sockets.size() <= m_flood_peers.size())
+    {
+        return;
+    }
+
+    // Round robin over the reconciliation peers by address; one exists as flood peers
+    // are a subset of the connected ones
+    auto it = m_peers_sockets.upper_bound(m_last_reconciled_peer);
+    while (it == m_peers_sockets.end() || m_flood_peers.count(it->first))
+    {
+        it = it == m_peers_sockets.end() ? m_peers_sockets.begin() : std::next(it);
+    }
+
+    m_last_reconciled_peer = it->first;
+
+    GhostDagMessage request(REQ_RECONCILIATION);
+    request.ids.push_back(static_cast<int>(m_reconciliation_sets[it->first].size()));
+    Address to = InetSocketAddress(it->first, m_ghostdag_port);
+    SendMessage(request, to);
+}
+
+void
+GhostDagNode::HandleReqReconciliation(const std::vector<int>& ids, Address& from)
+{
+    if (ids.empty())
+    {
+        return;
+    }
+
+    Ipv4Address ip = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    std::set<int>& snapshot = m_reconciliation_snapshots[ip];
+
+    // A snapshot whose diff never came is reconciled again
+    std::set<int>& set = m_reconciliation_sets[ip];
+    snapshot.insert(set.begin(), set.end());
+    set.clear();
+
+    int local_size = static_cast<int>(snapshot.size());
+    int remote_size = ids[0];
+    int capacity = std::abs(local_size - remote_size) +
+                   static_cast<int>(RECONCILIATION_Q * std::min(local_size, remote_size)) + 1;
+
+    GhostDagMessage reply(RECONCILIATION_SKETCH);
+    reply.sketch = SetSketch(capacity);
+    for (int tx_id : snapshot)
+    {
+        reply.sketch.Insert(static_cast<uint32_t>(tx_id));
+    }
+
+    SendMessage(reply, from);
+}
+
+void
+GhostDagNode::HandleReconciliationSketch(const SetSketch& sketch, Address& from)
+{
+    Ipv4Address ip = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    std::set<int>& set = m_reconciliation_sets[ip];
+
+    SetSketch local;
+    local.Reset(sketch.GetCellCount());
+    for (int tx_id : set)
+    {
+        local.Insert(static_cast<uint32_t>(tx_id));
+    }
+    local.Subtract(sketch);
+
+    std::vector<uint32_t> local_only;
+    std::vector<uint32_t> remote_only;
+    bool decoded = local.Decode(local_only, remote_only);
+
+    GhostDagMessage diff(RECONCILIATION_DIFF);
+    diff.ids.push_back(decoded ? 1 : 0);
+    diff.ids.push_back(0);
+
+    if (decoded)
+    {
+        for (uint32_t tx_id : remote_only)
+        {
+            if (AddTransactionAnnouncer(static_cast<int>(tx_id), ip))
+            {
+                diff.ids.push_back(static_cast<int>(tx_id));
+            }
+        }
+        diff.ids[1] = static_cast<int>(diff.ids.size()) - 2;
+        for (uint32_t tx_id : local_only)
+        {
+            diff.ids.push_back(static_cast<int>(tx_id));
+        }
+    }
+    else
+    {
+        NS_LOG_INFO("Node " << GetNode()->GetId() << " failed to decode sketch from " << ip
+                            << ", announcing " << set.size() << " transactions");
+        diff.ids.insert(diff.ids.end(), set.begin(), set.end());
+    }
+    set.clear();
+
+    SendMessage(diff, from);
+}
+
+void
+GhostDagNode::HandleReconciliationDiff(const std::vector<int>& ids, Address& from)
+{
+    if (ids.size() < 2 || ids[1] < 0 || static_cast<size_t>(ids[1]) > ids.size() - 2)
+    {
+        return;
+    }
+
+    Ipv4Address ip = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    auto snapshot = m_reconciliation_snapshots.find(ip);
+
+    auto requested_end = ids.begin() + 2 + ids[1];
+    std::vector<int> requested(ids.begin() + 2, requested_end);
+    std::vector<int> announced(requested_end, ids.end());
+
+    if (!requested.empty())
+    {
+        HandleReqTransactions(requested, from);
+    }
+    if (!announced.empty())
+    {
+        HandleInvTransactions(announced, from);
+    }
+
+    if (ids[0] == 0 && snapshot != m_reconciliation_snapshots.end() &&
+        !snapshot->second.empty())
+    {
+        GhostDagMessage inv(INV_TRANSACTIONS);
+        inv.ids.assign(snapshot->second.begin(), snapshot->second.end());
+        SendMessage(inv, from);
+    }
+
+    if (snapshot != m_reconciliation_snapshots.end())
+    {
+        m_reconciliation_snapshots.erase(snapshot);
+    }
+}
+
+// ============================================================================
+// Headers-First IBD
+// ============================================================================
+//
+// A node whose peer is more than IbdBlueScoreGap blue score ahead syncs in two
+// overlapping stages:
+//   1. SYNCING_HEADERS: header batches in GHOSTDAG order from the best peer are stored
+//      and coloured without bodies, and queued for download
+//   2. SYNCING_BLOCKS: once the headers are in, the remaining bodies are fetched
+// Bodies are requested from the start of the first stage, over a window of
+// BLOCK_DOWNLOAD_WINDOW blocks from the first missing one, spread over every peer whose
+// blue score covers the block. A peer with requests outstanding that delivers nothing for
+// SyncStallTimeout loses them to the others.
+
+void
+GhostDagNode::HandlePong(const std::vector<int>& ids, Address& from)
+{
+    if (ids.empty())
+    {
+        return;
+    }
+
+    Ipv4Address ip = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    m_peer_blue_scores[ip] = ids[0];
+    if (ids.size() > 1)
+    {
+        m_peers_upload_speeds[ip] = ids[1];
+    }
+
+    auto ping = m_ping_times.find(ip);
+    if (ping != m_ping_times.end())
+    {
+        double sample = Simulator::Now().GetSeconds() - ping->second;
+        auto rtt = m_peer_rtts.find(ip);
+        if (rtt == m_peer_rtts.end())
+        {
+            m_peer_rtts[ip] = sample;
+        }
+        else
+        {
+            rtt->second += RTT_SMOOTHING * (sample - rtt->second);
+        }
+        m_ping_times.erase(ping);
+    }
+
+    if (m_node_state == READY &&
+        ids[0] > m_blockchain.GetVirtualBlueScore() + static_cast<int>(m_ibd_blue_score_gap))
+    {
+        StartHeadersSync();
+    }
+}
+
+std::vector<int>
+GhostDagNode::BuildBlockLocator() const
+{
+    return m_blockchain.GetChainLocator(
+        m_blockchain.GetChainPosition(m_blockchain.GetSelectedTip()),
+        m_blockchain.GetChainPosition(m_blockchain.pruning_point));
+}
+
+void
+GhostDagNode::StartHeadersSync()
+{
+    bool found = false;
+    int best_score = 0;
+    for (const auto& [ip, score] : m_peer_blue_scores)
+    {
+        if (!m_peers_sockets.count(ip) || m_stalled_peers.count(ip))
+        {
+            continue;
+        }
+        if (!found || score > best_score)
+        {
+            m_sync_peer = ip;
+            best_score = score;
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        return;
+    }
+
+    if (m_node_state == READY)
+    {
+        m_sync_start_time = Simulator::Now().GetSeconds();
+    }
+    m_node_state = SYNCING_HEADERS;
+
+    NS_LOG_INFO("Node " << GetNode()->GetId() << " syncing headers from " << m_sync_peer
+                        << " at blue score " << best_score << ", local "
+                        << m_blockchain.GetVirtualBlueScore());
+
+    RequestHeaders(-1);
+
+    if (!m_sync_event.IsPending())
+    {
+        m_sync_event = Simulator::Schedule(Seconds(1), &GhostDagNode::CheckSyncProgress, this);
+    }
+}
+
+void
+GhostDagNode::RequestHeaders(int continue_after)
+{
+    GhostDagMessage request(REQ_HEADERS);
+    request.ids.push_back(continue_after);
+    std::vector<int> locator = BuildBlockLocator();
+    request.ids.insert(request.ids.end(), locator.begin(), locator.end());
+
+    m_last_headers_time = Simulator::Now().GetSeconds();
+    Address to = InetSocketAddress(m_sync_peer, m_ghostdag_port);
+    SendMessage(request, to);
+}
+
+void
+GhostDagNode::HandleReqHeaders(const std::vector<int>& locator, Address& from)
+{
+    if (locator.empty())
+    {
+        return;
+    }
+
+    // A sync in progress continues right after the last header it got. Otherwise the
+    // requester has the past of any of its chain blocks that is on our selected chain,
+    // which is exactly the ordering up to that block.
+    int start = -1;
+    if (locator[0] != -1)
+    {
+        start = m_blockchain.GetOrderingPosition(locator[0]);
+    }
+    for (size_t i = 1; i < locator.size() && start == -1; i++)
+    {
+        if (m_blockchain.IsOnSelectedChain(locator[i]))
+        {
+            start = m_blockchain.GetOrderingPosition(locator[i]);
+        }
+    }
+
+    GhostDagMessage reply(BLOCK_HEADERS);
+    for (int block_id : m_blockchain.GetOrderedBlocksFrom(start + 1, MAX_HEADERS_PER_BATCH))
+    {
+        reply.headers.push_back(m_blockchain.GetHeader(block_id));
+    }
+
+    SendMessage(reply, from);
+}
+
+void
+GhostDagNode::HandleBlockHeaders(const std::vector<BlockHeader>& headers, Address& from)
+{
+    if (m_node_state != SYNCING_HEADERS ||
+        InetSocketAddress::ConvertFrom(from).GetIpv4() != m_sync_peer)
+    {
+        return;
+    }
+
+    int added = 0;
+    for (const BlockHeader& header : headers)
+    {
+        int block_id = header.block_id;
+        if (m_blockchain.HasBlock(block_id) || m_blockchain.IsOrphan(block_id))
+        {
+            continue;
+        }
+
+        m_blockchain.AddHeader(header);
+        if (m_blockchain.HasBlock(block_id))
+        {
+            m_download_queue.push_back(block_id);
+            added++;
+        }
+    }
+    m_last_headers_time = Simulator::Now().GetSeconds();
+
+    // A full batch with nothing new would only repeat itself
+    if (static_cast<int>(headers.size()) == MAX_HEADERS_PER_BATCH && added > 0)
+    {
+        RequestHeaders(headers.back().block_id);
+    }
+    else
+    {
+        m_node_state = SYNCING_BLOCKS;
+        NS_LOG_INFO("Node " << GetNode()->GetId() << " headers synced at blue score "
+                            << m_blockchain.GetVirtualBlueScore() << ", "
+                            << m_download_queue.size() << " bodies to download");
+    }
+
+    RequestBlockBodies();
+}
+
+void
+GhostDagNode::RequestBlockBodies()
+{
+    while (!m_download_queue.empty() && (m_blockchain.HasBody(m_download_queue.front()) ||
+                                         !m_blockchain.HasBlock(m_download_queue.front())))
+    {
+        m_download_queue.pop_front();
+    }
+
+    if (m_download_queue.empty())
+    {
+        if (m_node_state == SYNCING_BLOCKS)
+        {
+            m_node_state = READY;
+            m_blocks_in_flight.clear();
+            m_peer_sync.clear();
+            m_stalled_peers.clear();
+            Simulator::Cancel(m_sync_event);
+            NS_LOG_INFO("Node " << GetNode()->GetId() << " synced to blue score "
+                                << m_blockchain.GetVirtualBlueScore() << " in "
+                                << Simulator::Now().GetSeconds() - m_sync_start_time << "s");
+        }
+        return;
+    }
+
+    double now = Simulator::Now().GetSeconds();
+    std::map<Ipv4Address, GhostDagMessage> requests;
+
+    int free_slots = 0;
+    for (const auto& [ip, socket] : m_peers_sockets)
+    {
+        if (!m_stalled_peers.count(ip))
+        {
+            free_slots += MAX_BLOCKS_IN_FLIGHT_PER_PEER - m_peer_sync[ip].blocks_in_flight;
+        }
+    }
+
+    int window = std::min(static_cast<int>(m_download_queue.size()), BLOCK_DOWNLOAD_WINDOW);
+    for (int i = 0; i < window && free_slots > 0; i++)
+    {
+        int block_id = m_download_queue[i];
+        if (m_blockchain.HasBody(block_id) || m_blocks_in_flight.count(block_id))
+        {
+            continue;
+        }
+
+        // The least loaded peer whose DAG reaches the block's blue score
+        int blue_score = m_blockchain.blocks.blue_score[block_id];
+        const Ipv4Address* best = nullptr;
+        int best_in_flight = MAX_BLOCKS_IN_FLIGHT_PER_PEER;
+        for (const auto& [ip, score] : m_peer_blue_scores)
+        {
+            if (score < blue_score || m_stalled_peers.count(ip) || !m_peers_sockets.count(ip))
+            {
+                continue;
+            }
+            int in_flight = m_peer_sync[ip].blocks_in_flight;
+            if (in_flight < best_in_flight)
+            {
+                best = &ip;
+                best_in_flight = in_flight;
+            }
+        }
+
+        if (!best)
+        {
+            continue;
+        }
+
+        PeerSyncState& peer = m_peer_sync[*best];
+        if (peer.blocks_in_flight == 0)
+        {
+            peer.last_progress = now;
+        }
+        peer.blocks_in_flight++;
+        free_slots--;
+        m_blocks_in_flight[block_id] = *best;
+        requests.try_emplace(*best, REQ_BLOCK_BODIES).first->second.ids.push_back(block_id);
+    }
+
+    for (auto& [ip, request] : requests)
+    {
+        Address to = InetSocketAddress(ip, m_ghostdag_port);
+        SendMessage(request, to);
+    }
+}
+
+void
+GhostDagNode::HandleReqBlockBodies(const std::vector<int>& block_ids, Address& from)
+{
+    for (int block_id : block_ids)
+    {
+        if (!m_blockchain.HasBody(block_id))
+        {
+            continue;
+        }
+
+        GhostDagMessage body(BLOCK_BODY);
+        body.block = m_blockchain.GetBlock(block_id);
+        SendMessage(body, from);
+    }
+}
+
+void
+GhostDagNode::HandleBlockBody(const Block& body, Address& from)
+{
+    int block_id = body.header.block_id;
+    if (!m_blockchain.HasBlock(block_id) || m_blockchain.HasBody(block_id))
+    {
+        ReleaseBlockRequest(block_id);
+        return;
+    }
+
+    // BLOCK_BODY only carries the id and transactions
+    Block block = body;
+    block.header = m_blockchain.GetHeader(block_id);
+    block.size_in_bytes = block.header.GetSizeInBytes();
+    for (const Transaction& tx : block.transactions)
+    {
+        block.size_in_bytes += tx.size_bytes;
+    }
+    block.time_received = Simulator::Now().GetSeconds();
+    block.received_from = InetSocketAddress::ConvertFrom(from).GetIpv4();
+
+    StoreBlockBody(block);
+}
+
+void
+GhostDagNode::StoreBlockBody(const Block& body)
+{
+    m_blockchain.SetBody(body);
+    RemoveConfirmedTransactions(body);
+    ReleaseBlockRequest(body.header.block_id);
+    RequestBlockBodies();
+}
+
+void
+GhostDagNode::ReleaseBlockRequest(int block_id)
+{
+    auto it = m_blocks_in_flight.find(block_id);
+    if (it == m_blocks_in_flight.end())
+    {
+        return;
+    }
+
+    PeerSyncState& peer = m_peer_sync[it->second];
+    peer.blocks_in_flight--;
+    peer.last_progress = Simulator::Now().GetSeconds();
+    m_blocks_in_flight.erase(it);
+}
+
+void
+GhostDagNode::CheckSyncProgress()
+{
+    if (m_node_state == READY)
+    {
+        return;
+    }
+
+    double now = Simulator::Now().GetSeconds();
+    double timeout = m_sync_stall_timeout.GetSeconds();
+
+    // Header sync moves to the next best peer if its peer left or went quiet
+    if (m_node_state == SYNCING_HEADERS &&
+        (!m_peers_sockets.count(m_sync_peer) || now - m_last_headers_time > timeout))
+    {
+        NS_LOG_INFO("Node " << GetNode()->GetId() << " header sync peer " << m_sync_peer
+                            << " stalled");
+        m_stalled_peers.insert(m_sync_peer);
+        m_node_state = SYNCING_BLOCKS;
+        StartHeadersSync();
+    }
+
+    for (auto& [ip, peer] : m_peer_sync)
+    {
+        if (peer.blocks_in_flight == 0 || now - peer.last_progress <= timeout)
+        {
+            continue;
+        }
+
+        NS_LOG_INFO("Node " << GetNode()->GetId() << " peer " << ip << " stalled with "
+                            << peer.blocks_in_flight << " bodies in flight");
+        if (m_node_stats)
+        {
+            m_node_stats->block_timeouts += peer.blocks_in_flight;
+        }
+
+        m_stalled_peers.insert(ip);
+        peer.blocks_in_flight = 0;
+        for (auto it = m_blocks_in_flight.begin(); it != m_blocks_in_flight.end();)
+        {
+            it = it->second == ip ? m_blocks_in_flight.erase(it) : std::next(it);
+        }
+    }
+
+    // With every peer stalled, they all get another chance
+    bool all_stalled = std::all_of(m_peers_sockets.begin(),
+                                   m_peers_sockets.end(),
+                                   [this](const auto& peer) {
+                                       return m_stalled_peers.count(peer.first) > 0;
+                                   });
+    if (all_stalled)
+    {
+        m_stalled_peers.clear();
+    }
+
+    RequestBlockBodies();
+
+    // A new header sync above may already have scheduled the next check
+    if (m_node_state != READY && !m_sync_event.IsPending())
+    {
+        m_sync_event = Simulator::Schedule(Seconds(1), &GhostDagNode::CheckSyncProgress, this);
+    }
+}
+
+// ============================================================================
+// Antipast Sync
+// ============================================================================
+//
+// Closes a gap with a peer, e.g. after a partition, in traffic proportional to the
+// divergence rather than to the DAG:
+//   1. REQ_BLOCK_LOCATOR: our selected chain from the tip down, blue score gaps doubling
+//   2. the peer answers BLOCK_LOCATOR with the highest entry it has and the entry above
+//      it, or -1 if it has our tip
+//   3. while the two aren't adjacent on our chain, a finer locator between them follows,
+//      halving the unknown stretch at least every round
+//   4. REQ_ANTIPAST with the highest shared chain block and our tips, answered with
+//      IDB_BLOCK for every block in neither nor in their past
+
+void
+GhostDagNode::StartAntipastSync(Ipv4Address peer)
+{
+    double now = Simulator::Now().GetSeconds();
+    auto it = m_antipast_syncs.find(peer);
+    if (it != m_antipast_syncs.end() && now - it->second < m_sync_stall_timeout.GetSeconds())
+    {
+        return;
+    }
+    m_antipast_syncs[peer] = now;
+
+    NS_LOG_INFO("Node " << GetNode()->GetId() << " starting antipast sync with " << peer);
+
+    GhostDagMessage locator(REQ_BLOCK_LOCATOR);
+    locator.ids = BuildBlockLocator();
+    Address to = InetSocketAddress(peer, m_ghostdag_port);
+    SendMessage(locator, to);
+}
+
+void
+GhostDagNode::HandleReqBlockLocator(const std::vector<int>& locator, Address& from)
+{
+    for (size_t i = 0; i < locator.size(); i++)
+    {
+        if (m_blockchain.HasBlock(locator[i]))
+        {
+            GhostDagMessage reply(BLOCK_LOCATOR);
+            reply.ids.push_back(i == 0 ? -1 : locator[i - 1]);
+            reply.ids.push_back(locator[i]);
+            SendMessage(reply, from);
+            return;
+        }
+    }
+
+    NS_LOG_INFO("Node " << GetNode()->GetId() << " shares no locator block with " << from);
+}
+
+void
+GhostDagNode::HandleBlockLocator(const std::vector<int>& bounds, Address& from)
+{
+    if (bounds.size() != 2)
+    {
+        return;
+    }
+
+    Ipv4Address ip = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    if (!m_antipast_syncs.count(ip))
+    {
+        return;
+    }
+
+    int high = m_blockchain.GetChainPosition(bounds[0]);
+    int low = m_blockchain.GetChainPosition(bounds[1]);
+
+    // Narrow down while there are chain blocks between the unknown and the shared entry
+    if (bounds[0] != -1 && high != -1 && low != -1 && high - low > 1)
+    {
+        GhostDagMessage locator(REQ_BLOCK_LOCATOR);
+        locator.ids = m_blockchain.GetChainLocator(high - 1, low);
+        SendMessage(locator, from);
+        return;
+    }
+
+    // The shared block may have left our chain since, its past is still shared
+    GhostDagMessage request(REQ_ANTIPAST);
+    request.ids.push_back(bounds[1]);
+    request.ids.insert(request.ids.end(),
+                       m_blockchain.GetVirtualParents().begin(),
+                       m_blockchain.GetVirtualParents().end());
+    SendMessage(request, from);
+    m_antipast_syncs.erase(ip);
+}
+
+void
+GhostDagNode::HandleReqAntipast(const std::vector<int>& block_ids, Address& from)
+{
+    std::vector<int> antipast = m_blockchain.GetAntipast(block_ids);
+
+    NS_LOG_INFO("Node " << GetNode()->GetId() << " sending antipast of " << antipast.size()
+                        << " blocks to " << from);
+
+    for (int block_id : antipast)
+    {
+        if (!m_blockchain.HasBody(block_id))
+        {
+            continue;
+        }
+        GhostDagMessage block(IDB_BLOCK);
+        block.block = m_blockchain.GetBlock(block_id);
+        SendMessage(block, from);
+    }
+}
+
+void
+GhostDagNode::HandleIdbBlock(const Block& new_block, Address& from)
+{
+    int block_id = new_block.header.block_id;
+    Block block = new_block;
+    block.time_received = Simulator::Now().GetSeconds();
+    block.received_from = InetSocketAddress::ConvertFrom(from).GetIpv4();
+
+    if (m_blockchain.HasBlock(block_id) && !m_blockchain.HasBody(block_id))
+    {
+        StoreBlockBody(block);
+        return;
+    }
+
+    if (m_blockchain.HasBlock(block_id) || m_blockchain.IsOrphan(block_id))
+    {
+        return;
+    }
+
+    m_queue_inv.erase(block_id);
+    m_parent_requests.erase(block_id);
+    ValidateBlock(block);
 }
 
 } // namespace ns3
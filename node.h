@@ -1,17 +1,56 @@
 #pragma once
 
+#include "address_manager.h"
 #include "dag.h"
+#include "stream_buffer.h"
+#include "timer_wheel.h"
+#include "wire_codec.h"
 
 #include "ns3/application.h"
 #include "ns3/ipv4-address.h"
 #include "ns3/ptr.h"
+#include "ns3/random-variable-stream.h"
 #include "ns3/socket.h"
 #include "ns3/traced-callback.h"
 
+#include <deque>
 #include <map>
+#include <set>
+#include <unordered_map>
 
 namespace ns3
 {
+// Announcements waiting to be sent to one peer. Blocks go out at the end of the current
+// event, transactions on the peer's next randomized trickle.
+struct PeerInventoryQueue
+{
+    std::vector<int> block_ids;
+    std::vector<int> tx_ids;
+    EventId block_flush;
+    EventId tx_flush;
+};
+
+// A transaction asked from one of the peers that announced it. If it hasn't arrived by the
+// deadline, or that peer disconnects, the next announcer is asked.
+struct TransactionRequest
+{
+    std::vector<Ipv4Address> announcers; // front is the peer requested from
+    Time deadline;
+};
+
+// Body download progress of one peer during IBD
+struct PeerSyncState
+{
+    int blocks_in_flight;
+    double last_progress; // last delivery, or when a request went out with none in flight
+
+    PeerSyncState()
+        : blocks_in_flight(0),
+          last_progress(0)
+    {
+    }
+};
+
 class GhostDagNode : public Application
 {
   public:
@@ -27,8 +66,17 @@ class GhostDagNode : public Application
     void SetPeersUploadSpeeds(const std::map<Ipv4Address, double>& peers_upload_speeds);
     void SetNodeInternetSpeeds(const NodeInternetSpeeds& internet_speeds);
     void SetNodeStats(NodeStats* node_stats);
+    const NodeStats* GetNodeStats() const;
     void ConnectToPeer(Ipv4Address peerIp, uint16_t port);
 
+    // Brings the stats up to date with what the node has seen so far, as StopApplication
+    // does. False if the node has no stats or has not started.
+    bool UpdateNodeStats();
+
+    // Gives this process every partition_count-th block and transaction id from partition
+    // on, so the processes of a distributed run never mint the same id
+    static void SetIdPartition(uint32_t partition, uint32_t partition_count);
+
   protected:
     // --- Application Lifecycle ---
     void DoDispose() override;
@@ -40,48 +88,98 @@ class GhostDagNode : public Application
     void HandleAccept(Ptr<Socket> socket, const Address& from);
     void HandlePeerClose(Ptr<Socket> socket);
     void HandlePeerError(Ptr<Socket> socket);
+    void HandleConnect(Ptr<Socket> socket);
+    Ptr<Socket> OpenPeerSocket(Ipv4Address peerIp);
     void DiscoverPeers();
+    void ConnectToKnownPeers();
+    bool IsLocalAddress(Ipv4Address ip) const;
     EventId m_pingEvent;
     void PingPeers();
 
     // --- Message Dispatcher ---
-    void ProcessMessage(enum Messages msg_type, std::string payload, Address& from);
+    void ProcessMessage(const GhostDagMessage& message, Address& from);
 
     // --- 1. Real-Time Propagation Handlers  ---
-    void HandleInvRelayBlock(const std::string& block_hash, Address& from);
-    void HandleReqRelayBlock(const std::string& block_hash, Address& from);
+    void HandleInvRelayBlock(const std::vector<int>& block_ids, Address& from);
+    void HandleReqRelayBlock(const std::vector<int>& block_ids, Address& from);
     void HandleBlock(const Block& new_block, Address& from);
 
+    // --- Compact block relay: header plus tx ids, rebuilt from the mempool ---
+    void SendRelayBlock(int block_id, Address& to);
+    void HandleCompactBlock(const GhostDagMessage& message, Address& from);
+    void HandleReqBlockTransactions(const std::vector<int>& ids, Address& from);
+    void HandleBlockTransactions(const Block& body, Address& from);
+
     // --- 2. Mempool management ---
-    void HandleInvTransactions(const std::vector<std::string>& tx_hashes, Address& from);
-    void HandleReqTransactions(const std::vector<std::string>& tx_hashes, Address& from);
+    void HandleInvTransactions(const std::vector<int>& tx_ids, Address& from);
+    void HandleReqTransactions(const std::vector<int>& tx_ids, Address& from);
     void HandleTransaction(const Transaction& tx, Address& from);
+    bool IsKnownTransaction(int tx_id) const;
+    bool AddTransactionAnnouncer(int tx_id, Ipv4Address peer);
+    void SetTransactionDeadline(int tx_id);
+    void ExpireTransactionRequests();
+    void RequestFromNextAnnouncers(const std::vector<int>& tx_ids);
+    void ScheduleNextTransaction();
+    void GenerateTransaction();
+
+    // --- Erlay-style reconciliation with the peers transactions aren't flooded to ---
+    void ReconcileNextPeer();
+    void HandleReqReconciliation(const std::vector<int>& ids, Address& from);
+    void HandleReconciliationSketch(const SetSketch& sketch, Address& from);
+    void HandleReconciliationDiff(const std::vector<int>& ids, Address& from);
+    void RegisterPeer(Ipv4Address ip, Ptr<Socket> socket);
+    void UnregisterPeer(Ipv4Address ip);
 
     // --- 3. GHOSTDAG Topology Handlers  ---
-    void HandleReqAntipast(const std::string& block_hash, Address& from);
+    void HandleReqAntipast(const std::vector<int>& block_ids, Address& from);
     void CheckForMissingParents(const Block& new_block, Address& from);
+    void StartAntipastSync(Ipv4Address peer);
+    void HandleReqBlockLocator(const std::vector<int>& locator, Address& from);
+    void HandleBlockLocator(const std::vector<int>& bounds, Address& from);
+    void HandleIdbBlock(const Block& block, Address& from);
 
     // --- 4. IBD / Sync Handlers (Bootstrap) ---
-    void HandleReqHeaders(const std::string& locator_hash, Address& from);
+    void HandleReqHeaders(const std::vector<int>& locator, Address& from);
     void HandleBlockHeaders(const std::vector<BlockHeader>& headers, Address& from);
-    void HandleReqBlockBodies(const std::vector<std::string>& block_hashes, Address& from);
-    void HandleBlockBody(const std::set<Transaction>& body, Address& from);
+    void HandleReqBlockBodies(const std::vector<int>& block_ids, Address& from);
+    void HandleBlockBody(const Block& body, Address& from);
+    void HandlePong(const std::vector<int>& ids, Address& from);
+    void StartHeadersSync();
+    void RequestHeaders(int continue_after);
+    void RequestBlockBodies();
+    void StoreBlockBody(const Block& body);
+    void ReleaseBlockRequest(int block_id);
+    void CheckSyncProgress();
+    std::vector<int> BuildBlockLocator() const;
 
     // --- Sending Helpers ---
-    void SendMessage(enum Messages type, std::string payload, Address& to);
-    void BroadcastInvBlock(const std::string& block_hash);
-    void BroadcastInvTransaction(const std::string& tx_hash);
+    void SendMessage(const GhostDagMessage& message, Address& to);
+    void SendPacket(Ptr<Socket> socket, Ptr<Packet> packet);
+    void BroadcastInvBlock(int block_id);
+    void BroadcastInvTransaction(int tx_id, Ipv4Address source);
+    void QueueInventory(Ipv4Address peer, Messages type, int id);
+    void FlushBlockInventory(Ipv4Address peer);
+    void FlushTransactionInventory(Ipv4Address peer);
+    void RecordMessageBytes(Messages type, uint32_t bytes, bool sent);
 
     // --- Internal Logic & State Management ---
+    void ScheduleNextBlock();
+    void MineBlock();
     void ValidateBlock(const Block& new_block);
     void Unorphan(const Block& new_block);
     void AdvertiseNewBlock(const Block& new_block);
+    void RemoveConfirmedTransactions(const Block& block);
 
     // --- Timeout & Queue Management ---
-    void InvTimeoutExpired(std::string block_hash);
-    bool ReceivedButNotValidated(std::string block_hash);
-    void RemoveReceivedButNotValidated(std::string block_hash);
-    bool OnlyHeadersReceived(std::string block_hash);
+    uint64_t GetInvTick() const;
+    void ArmInvTimeout(int block_id);
+    void AdvanceInvTimeouts();
+    void InvTimeoutExpired(int block_id);
+    void RequestRelayBlock(int block_id);
+    double EstimateBlockDelivery(Ipv4Address peer) const;
+    bool ReceivedButNotValidated(int block_id);
+    void RemoveReceivedButNotValidated(int block_id);
+    bool OnlyHeadersReceived(int block_id);
 
     // Metrics helpers
     void RemoveSendTime();
@@ -99,6 +197,8 @@ class GhostDagNode : public Application
     double m_previous_block_receive_time;
     double m_mean_block_propagation_time;
     double m_mean_block_size;
+    double m_mean_mempool_similarity;
+    int m_mempool_similarity_samples;
 
     // Core Structures
     Blockchain m_blockchain;
@@ -106,6 +206,50 @@ class GhostDagNode : public Application
     Time m_inv_timeout_minutes;
     bool m_is_miner;
     bool m_mine_not_synced;
+    bool m_audit_kcluster;
+    bool m_compact_blocks;
+    Time m_block_interval;
+    uint32_t m_max_block_size;
+    EventId m_mining_event;
+    Ptr<ExponentialRandomVariable> m_block_interval_rng;
+    Time m_transaction_interval;
+    EventId m_transaction_event;
+    Ptr<ExponentialRandomVariable> m_transaction_interval_rng;
+    bool m_tx_reconciliation;
+    uint32_t m_tx_flood_peers;
+    Time m_reconciliation_interval;
+    EventId m_reconciliation_event;
+    Time m_trickle_interval;
+    Ptr<ExponentialRandomVariable> m_trickle_rng;
+
+    // Headers-first IBD: headers come in batches from the best peer and are stored without
+    // bodies, which are then downloaded in GHOSTDAG order from every peer
+    uint32_t m_ibd_blue_score_gap;
+    Time m_sync_stall_timeout;
+    Ipv4Address m_sync_peer;
+    double m_sync_start_time;
+    double m_last_headers_time;
+    EventId m_sync_event;
+    std::map<Ipv4Address, int> m_peer_blue_scores;
+    std::deque<int> m_download_queue; // header-only blocks, front is the window base
+    std::map<int, Ipv4Address> m_blocks_in_flight;
+    std::map<Ipv4Address, PeerSyncState> m_peer_sync;
+    std::set<Ipv4Address> m_stalled_peers;
+
+    // Relay peer selection: a block announced by a slow peer is requested after a short
+    // wait for a faster announcer, from whichever announcer is expected to deliver first
+    bool m_serialization_delay;
+    Time m_max_relay_wait;
+    double m_upload_free_at;    // when the uplink finishes serializing what's queued
+    double m_relay_block_bytes; // smoothed size of the relay block messages received
+    std::map<Ipv4Address, double> m_peer_rtts;
+    std::map<Ipv4Address, double> m_ping_times;
+    std::map<int, EventId> m_relay_decisions;
+
+    // Antipast sync after a gap deeper than one block: locator rounds narrow down the
+    // highest shared chain block, then the peer sends what isn't in its past
+    std::set<int> m_parent_requests;                // fetched because a block needs them
+    std::map<Ipv4Address, double> m_antipast_syncs; // peer -> time the sync started
 
     // Network Params
     double m_download_speed;
@@ -114,17 +258,45 @@ class GhostDagNode : public Application
     int m_transaction_index_size;
 
     // Connectivity Maps
-    std::vector<Ipv4Address> m_peers_addresses;
+    AddressManager m_address_manager;
+    uint32_t m_address_group_bits;
+    uint32_t m_address_table_size;
     std::map<Ipv4Address, double> m_peers_download_speeds;
     std::map<Ipv4Address, double> m_peers_upload_speeds;
     std::map<Ipv4Address, Ptr<Socket>> m_peers_sockets;
+    std::map<Ipv4Address, PeerInventoryQueue> m_inventory_queues;
 
     // State Maps
-    std::map<std::string, std::vector<Address>> m_queue_inv;
-    std::map<std::string, EventId> m_inv_timeouts;
-    std::map<Address, std::string> m_buffered_data;
-    std::map<std::string, Block> m_received_not_validated;
-    std::map<std::string, Block> m_only_headers_received;
+    std::map<int, std::vector<Address>> m_queue_inv; // front is the peer requested from
+    TimerWheel m_inv_timeouts;                       // expired together on a periodic tick
+    Time m_inv_tick;
+    EventId m_inv_tick_event;
+    std::map<Ptr<Socket>, StreamBuffer> m_buffered_data;
+    std::map<int, Block> m_received_not_validated;
+    std::map<int, Block> m_only_headers_received; // compact blocks missing transactions
+    std::set<int> m_orphan_block_ids;             // orphans to announce once connected
+
+    // Transactions requested and not received yet, with their deadlines in the order they
+    // were set; entries of delivered or re-sent requests are skipped when reached
+    Time m_tx_request_timeout;
+    std::map<int, TransactionRequest> m_tx_requests;
+    std::deque<std::pair<Time, int>> m_tx_request_deadlines;
+    EventId m_tx_request_event;
+
+    // Ids confirmed by stored blocks, with the number of such blocks, so late announcements
+    // aren't requested again. Each block's ids are dropped once it is pruned.
+    std::unordered_map<int, int> m_confirmed_transactions;
+    std::deque<std::pair<int, std::vector<int>>> m_confirming_blocks; // oldest first
+
+    // Reconciliation: transactions still to reconcile with each non-flood peer, and the
+    // sets sketched for a peer's request until its diff arrives
+    std::set<Ipv4Address> m_flood_peers;
+    std::map<Ipv4Address, std::set<int>> m_reconciliation_sets;
+    std::map<Ipv4Address, std::set<int>> m_reconciliation_snapshots;
+    Ipv4Address m_last_reconciled_peer;
+
+    // Reused so decoding doesn't allocate per message
+    GhostDagMessage m_received_message;
 
     NodeStats* m_node_stats;
     NodeState m_node_state;
@@ -133,6 +305,7 @@ class GhostDagNode : public Application
 
     int m_ghostdag_port;
     uint8_t m_ghostdag_k;
+    uint32_t m_pruning_depth;
     int m_seconds_per_min;
     int m_count_bytes;
     int m_message_header_size;
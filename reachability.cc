@@ -0,0 +1,354 @@
+#include "reachability.h"
+
+#include <algorithm>
+
+namespace
+{
+const uint64_t ROOT_INTERVAL_END = uint64_t(1) << 62;
+
+// A new child takes all but 1/CHILD_RESERVE_FRACTION of the free space, so chains of
+// single children (the common case) shrink slowly and siblings trigger a local reindex
+const uint64_t CHILD_RESERVE_FRACTION = 16;
+
+// Room per block given to subtrees off the heaviest path when relabelling, and left free
+// under each block on that path for new children. A reindex climbs to an ancestor with
+// twice this per block in its subtree.
+const uint64_t REINDEX_SLACK = uint64_t(1) << 12;
+} // namespace
+
+ReachabilityData&
+Reachability::GetOrCreate(int block_id)
+{
+    nodes.EnsureBound(block_id + 1);
+    return nodes[block_id];
+}
+
+bool
+Reachability::HasBlock(int block_id) const
+{
+    return nodes.InWindow(block_id) && nodes[block_id].present;
+}
+
+void
+Reachability::AddRoot(int block_id)
+{
+    ReachabilityData& data = GetOrCreate(block_id);
+    data.present = true;
+    data.tree_parent = -1;
+    data.interval_start = 1;
+    data.interval_end = ROOT_INTERVAL_END;
+    root = block_id;
+}
+
+void
+Reachability::AddBlock(int block_id, int selected_parent, const std::vector<int>& mergeset)
+{
+    if (selected_parent == -1 || !HasBlock(selected_parent))
+    {
+        if (root == -1)
+        {
+            AddRoot(block_id);
+        }
+        return;
+    }
+
+    GetOrCreate(block_id).present = true;
+    AddTreeChild(selected_parent, block_id);
+
+    // Blocks in the past of the selected parent already reach the new block through it
+    for (int merged_id : mergeset)
+    {
+        InsertToFutureCoveringSet(merged_id, block_id);
+    }
+}
+
+void
+Reachability::Prune(const std::vector<int>& removed_ids, int new_root)
+{
+    for (int block_id : removed_ids)
+    {
+        nodes[block_id] = ReachabilityData();
+    }
+
+    // Remaining blocks drop every link into the pruned part; the intervals and covering
+    // set order of what is left are unchanged
+    for (int block_id = nodes.GetFirstId(); block_id < nodes.GetIdBound(); block_id++)
+    {
+        ReachabilityData& data = nodes[block_id];
+        if (!data.present)
+        {
+            continue;
+        }
+
+        auto is_pruned = [this](int id) { return !HasBlock(id); };
+        data.tree_children.erase(
+            std::remove_if(data.tree_children.begin(), data.tree_children.end(), is_pruned),
+            data.tree_children.end());
+        data.future_covering_set.erase(std::remove_if(data.future_covering_set.begin(),
+                                                      data.future_covering_set.end(),
+                                                      is_pruned),
+                                       data.future_covering_set.end());
+        if (data.tree_parent != -1 && !HasBlock(data.tree_parent))
+        {
+            data.tree_parent = -1;
+        }
+    }
+
+    root = new_root;
+    nodes[new_root].tree_parent = -1;
+
+    // The new root's interval is only what was left under it, so relabel the remaining
+    // forest: blocks kept from the old root's anticone never get tree children again
+    // and are packed tightly, and the new root takes the rest of the full range
+    std::vector<int> anticone_roots;
+    for (int block_id = nodes.GetFirstId(); block_id < nodes.GetIdBound(); block_id++)
+    {
+        if (block_id != new_root && nodes[block_id].present && nodes[block_id].tree_parent == -1)
+        {
+            anticone_roots.push_back(block_id);
+        }
+    }
+
+    std::unordered_map<int, uint64_t> subtree_sizes;
+    uint64_t next_start = 1;
+    for (int block_id : anticone_roots)
+    {
+        ReachabilityData& data = nodes[block_id];
+        data.interval_start = next_start;
+        data.interval_end = next_start + CountSubtree(block_id, subtree_sizes) - 1;
+        next_start = data.interval_end + 1;
+        PropagateIntervals(block_id, subtree_sizes);
+    }
+
+    nodes[new_root].interval_start = next_start;
+    nodes[new_root].interval_end = ROOT_INTERVAL_END;
+    CountSubtree(new_root, subtree_sizes);
+    PropagateIntervals(new_root, subtree_sizes);
+
+    // Relabelling keeps every tree relation, so covering sets only need re-sorting
+    for (int block_id = nodes.GetFirstId(); block_id < nodes.GetIdBound(); block_id++)
+    {
+        std::vector<int>& fcs = nodes[block_id].future_covering_set;
+        std::sort(fcs.begin(), fcs.end(), [this](int a, int b) {
+            return nodes[a].interval_start < nodes[b].interval_start;
+        });
+    }
+}
+
+bool
+Reachability::IsReachabilityTreeAncestorOf(int ancestor_id, int descendant_id) const
+{
+    if (!HasBlock(ancestor_id) || !HasBlock(descendant_id))
+    {
+        return false;
+    }
+
+    const ReachabilityData& ancestor = nodes[ancestor_id];
+    const ReachabilityData& descendant = nodes[descendant_id];
+    return ancestor.interval_start <= descendant.interval_start &&
+           descendant.interval_end <= ancestor.interval_end;
+}
+
+bool
+Reachability::IsDagAncestorOf(int ancestor_id, int descendant_id) const
+{
+    if (ancestor_id == descendant_id || !HasBlock(ancestor_id) || !HasBlock(descendant_id))
+    {
+        return false;
+    }
+
+    if (IsReachabilityTreeAncestorOf(ancestor_id, descendant_id))
+    {
+        return true;
+    }
+
+    // The only covering block that can contain the descendant is the last one starting
+    // at or before it
+    const std::vector<int>& fcs = nodes[ancestor_id].future_covering_set;
+    uint64_t target_start = nodes[descendant_id].interval_start;
+    auto it = std::upper_bound(fcs.begin(), fcs.end(), target_start, [this](uint64_t start, int id) {
+        return start < nodes[id].interval_start;
+    });
+
+    if (it == fcs.begin())
+    {
+        return false;
+    }
+    return IsReachabilityTreeAncestorOf(*(it - 1), descendant_id);
+}
+
+void
+Reachability::AddTreeChild(int parent_id, int child_id)
+{
+    ReachabilityData& parent = nodes[parent_id];
+    ReachabilityData& child = nodes[child_id];
+
+    uint64_t free_start = parent.tree_children.empty()
+                              ? parent.interval_start
+                              : nodes[parent.tree_children.back()].interval_end + 1;
+    uint64_t free_end = parent.interval_end - 1;
+
+    parent.tree_children.push_back(child_id);
+    child.tree_parent = parent_id;
+
+    if (free_end >= free_start)
+    {
+        uint64_t free_size = free_end + 1 - free_start;
+        uint64_t child_size = free_size - free_size / CHILD_RESERVE_FRACTION;
+        child.interval_start = free_start;
+        child.interval_end = free_start + child_size - 1;
+        return;
+    }
+
+    Reindex(parent_id);
+}
+
+void
+Reachability::InsertToFutureCoveringSet(int block_id, int future_block_id)
+{
+    std::vector<int>& fcs = nodes[block_id].future_covering_set;
+    uint64_t future_start = nodes[future_block_id].interval_start;
+
+    auto it = std::upper_bound(fcs.begin(), fcs.end(), future_start, [this](uint64_t start, int id) {
+        return start < nodes[id].interval_start;
+    });
+
+    // Already covered by a tree ancestor of the new block
+    if (it != fcs.begin() && IsReachabilityTreeAncestorOf(*(it - 1), future_block_id))
+    {
+        return;
+    }
+
+    fcs.insert(it, future_block_id);
+}
+
+void
+Reachability::Reindex(int parent_id)
+{
+    reindex_count++;
+
+    std::unordered_map<int, uint64_t> subtree_sizes;
+    int reindex_root = parent_id;
+    uint64_t subtree_size = CountSubtree(reindex_root, subtree_sizes);
+
+    while (reindex_root != root && nodes[reindex_root].tree_parent != -1 &&
+           nodes[reindex_root].IntervalSize() / (2 * REINDEX_SLACK) < subtree_size)
+    {
+        reindex_root = nodes[reindex_root].tree_parent;
+        subtree_size = CountSubtree(reindex_root, subtree_sizes);
+    }
+
+    reindexed_blocks += subtree_size;
+    PropagateIntervals(reindex_root, subtree_sizes);
+}
+
+uint64_t
+Reachability::CountSubtree(int block_id, std::unordered_map<int, uint64_t>& subtree_sizes) const
+{
+    // Iterative post-order walk, reusing sizes already counted by a previous call
+    std::vector<std::pair<int, bool>> stack;
+    stack.emplace_back(block_id, false);
+
+    while (!stack.empty())
+    {
+        auto [current, children_done] = stack.back();
+        stack.pop_back();
+
+        if (subtree_sizes.find(current) != subtree_sizes.end())
+        {
+            continue;
+        }
+
+        if (children_done)
+        {
+            uint64_t size = 1;
+            for (int child_id : nodes[current].tree_children)
+            {
+                size += subtree_sizes[child_id];
+            }
+            subtree_sizes[current] = size;
+            continue;
+        }
+
+        stack.emplace_back(current, true);
+        for (int child_id : nodes[current].tree_children)
+        {
+            if (subtree_sizes.find(child_id) == subtree_sizes.end())
+            {
+                stack.emplace_back(child_id, false);
+            }
+        }
+    }
+
+    return subtree_sizes[block_id];
+}
+
+void
+Reachability::PropagateIntervals(int block_id,
+                                 const std::unordered_map<int, uint64_t>& subtree_sizes)
+{
+    std::vector<int> stack;
+    stack.push_back(block_id);
+
+    while (!stack.empty())
+    {
+        int current = stack.back();
+        stack.pop_back();
+
+        const ReachabilityData& data = nodes[current];
+        if (data.tree_children.empty())
+        {
+            continue;
+        }
+
+        uint64_t children_total = 0;
+        int heavy_child = data.tree_children.front();
+        for (int child_id : data.tree_children)
+        {
+            children_total += subtree_sizes.at(child_id);
+            if (subtree_sizes.at(child_id) >= subtree_sizes.at(heavy_child))
+            {
+                heavy_child = child_id;
+            }
+        }
+
+        uint64_t range_size = data.interval_end - data.interval_start;
+        uint64_t heavy_subtree = subtree_sizes.at(heavy_child);
+        uint64_t light_room = (children_total - heavy_subtree) * REINDEX_SLACK;
+        uint64_t next_start = data.interval_start;
+
+        // The chain grows under the heaviest child, so that path keeps the spare room and
+        // the tip ends up with nearly all of it: the next reindex then only relabels what
+        // was added since. Without room for that, children keep their order and share the
+        // slack in proportion to their subtree sizes, with one extra share left free.
+        bool concentrate = range_size >= light_room + (heavy_subtree + 1) * REINDEX_SLACK;
+        uint64_t slack = range_size > children_total ? range_size - children_total : 0;
+
+        for (int child_id : data.tree_children)
+        {
+            uint64_t child_subtree = subtree_sizes.at(child_id);
+            uint64_t child_size;
+            if (!concentrate)
+            {
+                child_size = child_subtree +
+                             static_cast<uint64_t>(static_cast<unsigned __int128>(slack) *
+                                                   child_subtree / (children_total + 1));
+            }
+            else if (child_id == heavy_child)
+            {
+                child_size = range_size - light_room - REINDEX_SLACK;
+            }
+            else
+            {
+                child_size = child_subtree * REINDEX_SLACK;
+            }
+
+            ReachabilityData& child = nodes[child_id];
+            child.interval_start = next_start;
+            child.interval_end = next_start + child_size - 1;
+            next_start = child.interval_end + 1;
+
+            stack.push_back(child_id);
+        }
+    }
+}
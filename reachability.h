@@ -0,0 +1,66 @@
+#pragma once
+
+#include "block_id_vector.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Interval labels on the selected-parent tree plus future covering sets, answering
+// DAG ancestry queries without walking the DAG. Intervals are inclusive and a node's
+// own slot is the last value of its interval; children are allocated below it.
+struct ReachabilityData
+{
+    bool present;
+    int tree_parent;
+    uint64_t interval_start;
+    uint64_t interval_end;
+    std::vector<int> tree_children;
+    // Blocks in the future of this one that are not reachability-tree descendants of it,
+    // kept as an antichain sorted by interval start
+    std::vector<int> future_covering_set;
+
+    ReachabilityData()
+        : present(false),
+          tree_parent(-1),
+          interval_start(1),
+          interval_end(0)
+    {
+    }
+
+    uint64_t IntervalSize() const
+    {
+        return interval_end + 1 - interval_start;
+    }
+};
+
+struct Reachability
+{
+    Reachability()
+        : root(-1),
+          reindex_count(0),
+          reindexed_blocks(0)
+    {
+    }
+
+    int root;
+    int reindex_count;
+    uint64_t reindexed_blocks; // blocks relabelled by all reindexes so far
+    BlockIdVector<ReachabilityData> nodes;
+
+    void AddRoot(int block_id);
+    void AddBlock(int block_id, int selected_parent, const std::vector<int>& mergeset);
+    void Prune(const std::vector<int>& removed_ids, int new_root);
+
+    bool HasBlock(int block_id) const;
+    bool IsReachabilityTreeAncestorOf(int ancestor_id, int descendant_id) const;
+    bool IsDagAncestorOf(int ancestor_id, int descendant_id) const;
+
+    void AddTreeChild(int parent_id, int child_id);
+    void InsertToFutureCoveringSet(int block_id, int future_block_id);
+    void Reindex(int parent_id);
+    uint64_t CountSubtree(int block_id, std::unordered_map<int, uint64_t>& subtree_sizes) const;
+    void PropagateIntervals(int block_id, const std::unordered_map<int, uint64_t>& subtree_sizes);
+
+    ReachabilityData& GetOrCreate(int block_id);
+};
@@ -0,0 +1,111 @@
+#include "set_sketch.h"
+
+#include "hash.h"
+
+namespace
+{
+const uint32_t CHECKSUM_SEED = 0x9e3779b9;
+} // namespace
+
+SetSketch::SetSketch(int capacity)
+    : cells(CellsForCapacity(capacity), Cell{0, 0, 0})
+{
+}
+
+int
+SetSketch::CellsForCapacity(int capacity)
+{
+    // Three hashes peel large tables from about 1.3 cells per id, small ones need slack
+    int cells = 2 * capacity + 3 * HASH_COUNT;
+    return (cells + HASH_COUNT - 1) / HASH_COUNT * HASH_COUNT;
+}
+
+void
+SetSketch::Reset(int cell_count)
+{
+    cells.assign(cell_count, Cell{0, 0, 0});
+}
+
+void
+SetSketch::Insert(uint32_t id)
+{
+    Toggle(id, 1);
+}
+
+void
+SetSketch::Toggle(uint32_t id, int32_t delta)
+{
+    uint32_t partition = static_cast<uint32_t>(cells.size()) / HASH_COUNT;
+    uint32_t checksum = Mix32(id, CHECKSUM_SEED);
+    for (uint32_t i = 0; i < HASH_COUNT; i++)
+    {
+        Cell& cell = cells[i * partition + Mix32(id, i) % partition];
+        cell.count += delta;
+        cell.id_sum ^= id;
+        cell.hash_sum ^= checksum;
+    }
+}
+
+void
+SetSketch::Subtract(const SetSketch& other)
+{
+    for (size_t i = 0; i < cells.size() && i < other.cells.size(); i++)
+    {
+        cells[i].count -= other.cells[i].count;
+        cells[i].id_sum ^= other.cells[i].id_sum;
+        cells[i].hash_sum ^= other.cells[i].hash_sum;
+    }
+}
+
+bool
+SetSketch::IsPure(const Cell& cell) const
+{
+    return (cell.count == 1 || cell.count == -1) &&
+           cell.hash_sum == Mix32(cell.id_sum, CHECKSUM_SEED);
+}
+
+bool
+SetSketch::Decode(std::vector<uint32_t>& local, std::vector<uint32_t>& remote)
+{
+    std::vector<size_t> pure;
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+        if (IsPure(cells[i]))
+        {
+            pure.push_back(i);
+        }
+    }
+
+    while (!pure.empty())
+    {
+        Cell cell = cells[pure.back()];
+        pure.pop_back();
+        // Peeling an earlier id may have emptied or spoiled this cell
+        if (!IsPure(cell))
+        {
+            continue;
+        }
+
+        (cell.count > 0 ? local : remote).push_back(cell.id_sum);
+        Toggle(cell.id_sum, -cell.count);
+
+        uint32_t partition = static_cast<uint32_t>(cells.size()) / HASH_COUNT;
+        for (uint32_t i = 0; i < HASH_COUNT; i++)
+        {
+            size_t index = i * partition + Mix32(cell.id_sum, i) % partition;
+            if (IsPure(cells[index]))
+            {
+                pure.push_back(index);
+            }
+        }
+    }
+
+    for (const Cell& cell : cells)
+    {
+        if (cell.count != 0 || cell.id_sum != 0 || cell.hash_sum != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Invertible Bloom lookup table over 32-bit ids, used to reconcile the transaction sets
+// of two peers. Each side inserts its ids; subtracting one sketch from the other leaves
+// only the symmetric difference, which decodes as long as it is not much larger than
+// the capacity the sketch was sized for. Cells are split into one partition per hash so
+// an id never lands twice in the same cell.
+struct SetSketch
+{
+    struct Cell
+    {
+        int32_t count;
+        uint32_t id_sum;   // xor of the ids in the cell
+        uint32_t hash_sum; // xor of a checksum of each id, tells pure cells apart
+    };
+
+    static const int HASH_COUNT = 3;
+
+    std::vector<Cell> cells;
+
+    SetSketch()
+    {
+    }
+
+    // Sized so a difference of up to capacity ids decodes with high probability
+    explicit SetSketch(int capacity);
+
+    static int CellsForCapacity(int capacity);
+
+    // Empties the sketch to cell_count cells, e.g. to match a peer's sketch
+    void Reset(int cell_count);
+
+    void Insert(uint32_t id);
+    void Subtract(const SetSketch& other);
+
+    // Peels the sketch, emptying it. local gets the ids with a positive count (inserted
+    // on this side only), remote those with a negative count. False if some cells could
+    // not be peeled, in which case both lists are partial.
+    bool Decode(std::vector<uint32_t>& local, std::vector<uint32_t>& remote);
+
+    int GetCellCount() const
+    {
+        return static_cast<int>(cells.size());
+    }
+
+  private:
+    void Toggle(uint32_t id, int32_t delta);
+    bool IsPure(const Cell& cell) const;
+};
@@ -0,0 +1,65 @@
+#include "stats_sampler.h"
+
+#include "stats_writer.h"
+
+#include "ns3/simulator.h"
+
+#include <iomanip>
+
+namespace ns3
+{
+
+bool
+StatsSampler::Open(const std::string& path)
+{
+    // libstdc++ only takes a buffer before the file is opened
+    m_buffer.resize(BUFFER_SIZE);
+    m_file.rdbuf()->pubsetbuf(m_buffer.data(), m_buffer.size());
+    m_file.open(path);
+    if (!m_file)
+    {
+        return false;
+    }
+
+    m_file << std::setprecision(9) << "time,";
+    WriteNodeStatsHeader(m_file);
+    m_file << "\n";
+    return true;
+}
+
+void
+StatsSampler::Start(Time interval, const std::vector<Ptr<GhostDagNode>>& apps)
+{
+    m_interval = interval;
+    m_apps = apps;
+    m_event = Simulator::Schedule(m_interval, &StatsSampler::Sample, this);
+}
+
+void
+StatsSampler::Stop()
+{
+    Simulator::Cancel(m_event);
+    m_apps.clear();
+    if (m_file.is_open())
+    {
+        m_file.flush();
+    }
+}
+
+void
+StatsSampler::Sample()
+{
+    double now = Simulator::Now().GetSeconds();
+    for (const Ptr<GhostDagNode>& app : m_apps)
+    {
+        if (app && app->UpdateNodeStats())
+        {
+            m_file << now << ",";
+            WriteNodeStatsRow(m_file, *app->GetNodeStats());
+            m_file << "\n";
+        }
+    }
+    m_event = Simulator::Schedule(m_interval, &StatsSampler::Sample, this);
+}
+
+} // namespace ns3
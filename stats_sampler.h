@@ -0,0 +1,44 @@
+#pragma once
+
+#include "node.h"
+
+#include "ns3/event-id.h"
+#include "ns3/nstime.h"
+#include "ns3/ptr.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ns3
+{
+// Appends the NodeStats of every running node to a CSV time series each interval of
+// simulated time, one row per node prefixed with the time in seconds. The file goes
+// through a large stream buffer so rows reach the disk in big writes. Nothing is
+// scheduled until Start, so a run without sampling pays nothing for it.
+class StatsSampler
+{
+  public:
+    // Creates the file and writes its header; false if it cannot be created
+    bool Open(const std::string& path);
+
+    // Samples at every multiple of interval until Stop. Apps may be null, e.g. those of
+    // other processes, and must have their stats set to be sampled.
+    void Start(Time interval, const std::vector<Ptr<GhostDagNode>>& apps);
+
+    // Cancels the next sample and flushes the file; call it before Simulator::Destroy
+    void Stop();
+
+  private:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    void Sample();
+
+    std::vector<char> m_buffer;
+    std::ofstream m_file;
+    Time m_interval;
+    std::vector<Ptr<GhostDagNode>> m_apps;
+    EventId m_event;
+};
+
+} // namespace ns3
@@ -0,0 +1,88 @@
+#include "stats_writer.h"
+
+namespace ns3
+{
+
+namespace
+{
+struct Column
+{
+    const char* name;
+    void (*write)(std::ostream& out, const NodeStats& stats);
+};
+
+// Header and rows both come from this table so they cannot drift apart
+const Column COLUMNS[] = {
+    {"node_id", [](std::ostream& out, const NodeStats& s) { out << s.node_id; }},
+    {"mean_block_receive_time",
+     [](std::ostream& out, const NodeStats& s) { out << s.mean_block_receive_time; }},
+    {"mean_block_propagation_time",
+     [](std::ostream& out, const NodeStats& s) { out << s.mean_block_propagation_time; }},
+    {"mean_block_size", [](std::ostream& out, const NodeStats& s) { out << s.mean_block_size; }},
+    {"total_blocks", [](std::ostream& out, const NodeStats& s) { out << s.total_blocks; }},
+    {"blue_blocks", [](std::ostream& out, const NodeStats& s) { out << s.blue_blocks; }},
+    {"red_blocks", [](std::ostream& out, const NodeStats& s) { out << s.red_blocks; }},
+    {"orphan_rate", [](std::ostream& out, const NodeStats& s) { out << s.orphan_rate; }},
+    {"is_miner", [](std::ostream& out, const NodeStats& s) { out << s.is_miner; }},
+    {"miner_generated_blocks",
+     [](std::ostream& out, const NodeStats& s) { out << s.miner_generated_blocks; }},
+    {"miner_average_block_gen_interval",
+     [](std::ostream& out, const NodeStats& s) { out << s.miner_average_block_gen_interval; }},
+    {"miner_average_block_size",
+     [](std::ostream& out, const NodeStats& s) { out << s.miner_average_block_size; }},
+    {"hash_rate", [](std::ostream& out, const NodeStats& s) { out << s.hash_rate; }},
+    {"attack_success", [](std::ostream& out, const NodeStats& s) { out << s.attack_success; }},
+    {"inv_received_bytes",
+     [](std::ostream& out, const NodeStats& s) { out << s.inv_received_bytes; }},
+    {"inv_sent_bytes", [](std::ostream& out, const NodeStats& s) { out << s.inv_sent_bytes; }},
+    {"get_headers_received_bytes",
+     [](std::ostream& out, const NodeStats& s) { out << s.get_headers_received_bytes; }},
+    {"get_headers_sent_bytes",
+     [](std::ostream& out, const NodeStats& s) { out << s.get_headers_sent_bytes; }},
+    {"headers_received_bytes",
+     [](std::ostream& out, const NodeStats& s) { out << s.headers_received_bytes; }},
+    {"headers_sent_bytes",
+     [](std::ostream& out, const NodeStats& s) { out << s.headers_sent_bytes; }},
+    {"get_data_received_bytes",
+     [](std::ostream& out, const NodeStats& s) { out << s.get_data_received_bytes; }},
+    {"get_data_sent_bytes",
+     [](std::ostream& out, const NodeStats& s) { out << s.get_data_sent_bytes; }},
+    {"block_received_bytes",
+     [](std::ostream& out, const NodeStats& s) { out << s.block_received_bytes; }},
+    {"block_sent_bytes", [](std::ostream& out, const NodeStats& s) { out << s.block_sent_bytes; }},
+    {"connections", [](std::ostream& out, const NodeStats& s) { out << s.connections; }},
+    {"block_timeouts", [](std::ostream& out, const NodeStats& s) { out << s.block_timeouts; }},
+    {"total_validation_time",
+     [](std::ostream& out, const NodeStats& s) { out << s.total_validation_time; }},
+    {"max_dag_width_seen",
+     [](std::ostream& out, const NodeStats& s) { out << s.max_dag_width_seen; }},
+    {"dag_width", [](std::ostream& out, const NodeStats& s) { out << s.dag_width; }},
+    {"mempool_similarity_score",
+     [](std::ostream& out, const NodeStats& s) { out << s.mempool_similarity_score; }},
+};
+} // namespace
+
+void
+WriteNodeStatsHeader(std::ostream& out)
+{
+    const char* separator = "";
+    for (const Column& column : COLUMNS)
+    {
+        out << separator << column.name;
+        separator = ",";
+    }
+}
+
+void
+WriteNodeStatsRow(std::ostream& out, const NodeStats& stats)
+{
+    const char* separator = "";
+    for (const Column& column : COLUMNS)
+    {
+        out << separator;
+        column.write(out, stats);
+        separator = ",";
+    }
+}
+
+} // namespace ns3
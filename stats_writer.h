@@ -0,0 +1,14 @@
+#pragma once
+
+#include "dag.h"
+
+#include <ostream>
+
+namespace ns3
+{
+// NodeStats as comma separated columns, one per field in declaration order. Neither
+// writes a line end, so callers can put their own columns in front.
+void WriteNodeStatsHeader(std::ostream& out);
+void WriteNodeStatsRow(std::ostream& out, const NodeStats& stats);
+
+} // namespace ns3
@@ -0,0 +1,154 @@
+#include "stream_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ns3
+{
+
+namespace
+{
+const uint32_t INITIAL_CAPACITY = 4096;
+} // namespace
+
+StreamBuffer::StreamBuffer()
+    : m_start(0),
+      m_size(0),
+      m_padding_to_skip(0)
+{
+}
+
+void
+StreamBuffer::Append(Ptr<Packet> packet)
+{
+    // Padding of an already decoded frame is never copied out of the packet
+    if (m_padding_to_skip > 0)
+    {
+        uint32_t skipped = std::min(m_padding_to_skip, packet->GetSize());
+        packet->RemoveAtStart(skipped);
+        m_padding_to_skip -= skipped;
+    }
+
+    uint32_t size = packet->GetSize();
+    if (size == 0)
+    {
+        return;
+    }
+
+    if (m_size + size > m_ring.size())
+    {
+        Grow(m_size + size);
+    }
+
+    uint32_t mask = m_ring.size() - 1;
+    uint32_t end = (m_start + m_size) & mask;
+    uint32_t first_part = std::min(size, static_cast<uint32_t>(m_ring.size()) - end);
+
+    packet->CopyData(m_ring.data() + end, first_part);
+    if (first_part < size)
+    {
+        packet->RemoveAtStart(first_part);
+        packet->CopyData(m_ring.data(), size - first_part);
+    }
+    m_size += size;
+}
+
+FrameStatus
+StreamBuffer::NextFrame(GhostDagMessage& message, uint32_t& frame_size)
+{
+    if (m_size < FRAME_HEADER_SIZE)
+    {
+        return FRAME_INCOMPLETE;
+    }
+
+    uint8_t header[FRAME_HEADER_SIZE];
+    CopyOut(0, FRAME_HEADER_SIZE, header);
+
+    FrameInfo info;
+    PeekFrame(header, FRAME_HEADER_SIZE, info);
+    if (!IsFrameValid(info))
+    {
+        return FRAME_MALFORMED;
+    }
+
+    uint32_t decode_size = FRAME_HEADER_SIZE + info.payload_size;
+    if (m_size < decode_size)
+    {
+        return FRAME_INCOMPLETE;
+    }
+
+    const uint8_t* data;
+    if (m_start + decode_size <= m_ring.size())
+    {
+        data = m_ring.data() + m_start;
+    }
+    else
+    {
+        if (m_scratch.size() < decode_size)
+        {
+            m_scratch.resize(decode_size);
+        }
+        CopyOut(0, decode_size, m_scratch.data());
+        data = m_scratch.data();
+    }
+
+    if (!DecodeFrame(data, info, message))
+    {
+        return FRAME_MALFORMED;
+    }
+
+    // Whatever padding hasn't arrived yet is skipped in Append
+    uint32_t padding = info.frame_size - decode_size;
+    uint32_t buffered_padding = std::min(padding, m_size - decode_size);
+    Consume(decode_size + buffered_padding);
+    m_padding_to_skip = padding - buffered_padding;
+
+    frame_size = info.frame_size;
+    return FRAME_DECODED;
+}
+
+void
+StreamBuffer::Clear()
+{
+    m_start = 0;
+    m_size = 0;
+    m_padding_to_skip = 0;
+}
+
+void
+StreamBuffer::Grow(uint32_t min_capacity)
+{
+    uint32_t capacity = std::max(INITIAL_CAPACITY, static_cast<uint32_t>(m_ring.size()));
+    while (capacity < min_capacity)
+    {
+        capacity *= 2;
+    }
+
+    std::vector<uint8_t> ring(capacity);
+    CopyOut(0, m_size, ring.data());
+    m_ring.swap(ring);
+    m_start = 0;
+}
+
+void
+StreamBuffer::Consume(uint32_t size)
+{
+    m_size -= size;
+    m_start = m_size == 0 ? 0 : (m_start + size) & (m_ring.size() - 1);
+}
+
+void
+StreamBuffer::CopyOut(uint32_t offset, uint32_t size, uint8_t* target) const
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    uint32_t begin = (m_start + offset) & (m_ring.size() - 1);
+    uint32_t first_part = std::min(size, static_cast<uint32_t>(m_ring.size()) - begin);
+    std::memcpy(target, m_ring.data() + begin, first_part);
+    std::memcpy(target + first_part, m_ring.data(), size - first_part);
+}
+
+} // namespace ns3
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "wire_codec.h"
+
+#include "ns3/packet.h"
+#include "ns3/ptr.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace ns3
+{
+enum FrameStatus
+{
+    FRAME_DECODED,
+    FRAME_INCOMPLETE,
+    FRAME_MALFORMED
+};
+
+// Reassembles the frames of one TCP connection. Received bytes go into a ring buffer
+// that grows in powers of two; frames are decoded in place unless they wrap around the
+// end of the ring. Once a frame's payload is decoded its padding is dropped as it
+// arrives, so a large block never has to be buffered or copied in full.
+class StreamBuffer
+{
+  public:
+    StreamBuffer();
+
+    // Takes the bytes of a received packet; the packet is consumed
+    void Append(Ptr<Packet> packet);
+
+    // Decodes the next complete frame into message and sets frame_size to its full size
+    // on the wire. A malformed frame leaves the stream unusable, so Clear it.
+    FrameStatus NextFrame(GhostDagMessage& message, uint32_t& frame_size);
+
+    void Clear();
+
+    uint32_t GetBufferedSize() const
+    {
+        return m_size;
+    }
+
+  private:
+    void Grow(uint32_t min_capacity);
+    void Consume(uint32_t size);
+    void CopyOut(uint32_t offset, uint32_t size, uint8_t* target) const;
+
+    std::vector<uint8_t> m_ring;
+    uint32_t m_start;
+    uint32_t m_size;
+    uint32_t m_padding_to_skip;
+
+    // Holds a frame that wraps around the end of the ring
+    std::vector<uint8_t> m_scratch;
+};
+
+} // namespace ns3
@@ -0,0 +1,444 @@
+// Runs discovery_test over a parameter grid, one simulation process per core.
+//
+// It lives outside the scratch directory so ns-3 doesn't link its main() into the
+// simulation, and needs nothing but POSIX, e.g.:
+//
+//   g++ -std=c++17 -O2 sweep.cc -o sweep
+//   ./sweep grid.txt [--jobs=N] [--dry-run]
+//
+// The grid file has one "name = value ..." line per parameter, passed to the binary as
+// --name=value; the points are every combination of the values, the first parameter
+// varying slowest. A few names configure the sweep itself instead, see SweepSpec.
+// Each run of a point gets --RngSeed=seed and its own --RngRun, so any run can be
+// replayed alone, and writes its nodes' stats to workdir/point<P>_run<R>.csv with its
+// output in a .log next to it. The stats of all runs end up in one CSV, prefixed with
+// the point, run and parameter columns.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+struct SweepSpec
+{
+    std::vector<std::string> binary; // command prefix, e.g. the path to discovery_test
+    int runs = 1;                    // replications of every point
+    int jobs = 0;                    // processes at once, 0 = one per core
+    unsigned seed = 1;               // RngSeed shared by all runs
+    std::string workdir = "sweep_runs";
+    std::string output = "sweep_results.csv";
+    std::vector<std::pair<std::string, std::vector<std::string>>> parameters;
+};
+
+struct Job
+{
+    int point;
+    int run;
+    int rng_run;
+    std::vector<std::string> values; // one per parameter
+    std::string stats_path;
+    std::string log_path;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+bool
+ParseOption(const char* arg, const char* name, std::string& value)
+{
+    size_t name_length = std::strlen(name);
+    if (std::strncmp(arg, name, name_length) != 0 || arg[name_length] != '=')
+    {
+        return false;
+    }
+    value = arg + name_length + 1;
+    return true;
+}
+
+std::vector<std::string>
+SplitWords(const std::string& text)
+{
+    std::vector<std::string> words;
+    std::istringstream stream(text);
+    std::string word;
+    while (stream >> word)
+    {
+        words.push_back(word);
+    }
+    return words;
+}
+
+bool
+ReadSpec(const char* path, SweepSpec& spec)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::fprintf(stderr, "cannot read %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line))
+    {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        if (SplitWords(line).empty())
+        {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        std::vector<std::string> name = SplitWords(line.substr(0, equals));
+        std::vector<std::string> values =
+            equals == std::string::npos ? std::vector<std::string>()
+                                        : SplitWords(line.substr(equals + 1));
+        if (name.size() != 1 || values.empty())
+        {
+            std::fprintf(stderr, "%s:%d: expected name = value ...\n", path, line_number);
+            return false;
+        }
+
+        if (name[0] == "binary")
+        {
+            spec.binary = values;
+        }
+        else if (name[0] == "runs")
+        {
+            spec.runs = std::atoi(values[0].c_str());
+        }
+        else if (name[0] == "jobs")
+        {
+            spec.jobs = std::atoi(values[0].c_str());
+        }
+        else if (name[0] == "seed")
+        {
+            spec.seed = static_cast<unsigned>(std::strtoul(values[0].c_str(), nullptr, 10));
+        }
+        else if (name[0] == "workdir")
+        {
+            spec.workdir = values[0];
+        }
+        else if (name[0] == "output")
+        {
+            spec.output = values[0];
+        }
+        else
+        {
+            spec.parameters.emplace_back(name[0], values);
+        }
+    }
+
+    if (spec.binary.empty() || spec.runs < 1 || spec.seed == 0)
+    {
+        std::fprintf(stderr, "%s: needs a binary, runs >= 1 and seed >= 1\n", path);
+        return false;
+    }
+    return true;
+}
+
+std::vector<Job>
+ExpandGrid(const SweepSpec& spec)
+{
+    size_t points = 1;
+    for (const auto& parameter : spec.parameters)
+    {
+        points *= parameter.second.size();
+    }
+
+    std::vector<Job> jobs;
+    jobs.reserve(points * spec.runs);
+    for (size_t point = 0; point < points; point++)
+    {
+        // Mixed radix digits of the point index, the last parameter varying fastest
+        std::vector<std::string> values(spec.parameters.size());
+        size_t rest = point;
+        for (size_t p = spec.parameters.size(); p-- > 0;)
+        {
+            const std::vector<std::string>& choices = spec.parameters[p].second;
+            values[p] = choices[rest % choices.size()];
+            rest /= choices.size();
+        }
+
+        for (int run = 0; run < spec.runs; run++)
+        {
+            Job job;
+            job.point = static_cast<int>(point);
+            job.run = run;
+            job.rng_run = static_cast<int>(point) * spec.runs + run + 1;
+            job.values = values;
+            std::string base = spec.workdir + "/point" + std::to_string(point) + "_run" +
+                               std::to_string(run);
+            job.stats_path = base + ".csv";
+            job.log_path = base + ".log";
+            jobs.push_back(job);
+        }
+    }
+    return jobs;
+}
+
+std::vector<std::string>
+BuildCommand(const SweepSpec& spec, const Job& job)
+{
+    std::vector<std::string> args = spec.binary;
+    for (size_t p = 0; p < spec.parameters.size(); p++)
+    {
+        args.push_back("--" + spec.parameters[p].first + "=" + job.values[p]);
+    }
+    args.push_back("--RngSeed=" + std::to_string(spec.seed));
+    args.push_back("--RngRun=" + std::to_string(job.rng_run));
+    args.push_back("--statsFile=" + job.stats_path);
+    return args;
+}
+
+// Starts the command with its output going to log_path; -1 if it could not fork
+pid_t
+Launch(const std::vector<std::string>& args, const std::string& log_path)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        return pid;
+    }
+
+    int log = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log >= 0)
+    {
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        close(log);
+    }
+
+    std::vector<char*> argv;
+    for (const std::string& arg : args)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    execvp(argv[0], argv.data());
+    std::perror(argv[0]);
+    _exit(127);
+}
+
+// Appends the stats rows of a finished run; the first run also writes the header
+bool
+MergeStats(const SweepSpec& spec, const Job& job, std::ofstream& out, std::string& header)
+{
+    std::ifstream in(job.stats_path);
+    std::string line;
+    if (!std::getline(in, line))
+    {
+        return false;
+    }
+    if (header.empty())
+    {
+        header = line;
+        out << "point,run,rng_run";
+        for (const auto& parameter : spec.parameters)
+        {
+            out << "," << parameter.first;
+        }
+        out << "," << header << "\n";
+    }
+    else if (line != header)
+    {
+        return false;
+    }
+
+    std::string prefix = std::to_string(job.point) + "," + std::to_string(job.run) + "," +
+                         std::to_string(job.rng_run);
+    for (const std::string& value : job.values)
+    {
+        prefix += "," + value;
+    }
+    while (std::getline(in, line))
+    {
+        if (!line.empty())
+        {
+            out << prefix << "," << line << "\n";
+        }
+    }
+    return true;
+}
+
+std::string
+JoinCommand(const std::vector<std::string>& args)
+{
+    std::string command;
+    for (const std::string& arg : args)
+    {
+        command += (command.empty() ? "" : " ") + arg;
+    }
+    return command;
+}
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    const char* spec_path = nullptr;
+    int jobs_override = 0;
+    bool dry_run = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (ParseOption(argv[i], "--jobs", value))
+        {
+            jobs_override = std::atoi(value.c_str());
+        }
+        else if (std::strcmp(argv[i], "--dry-run") == 0)
+        {
+            dry_run = true;
+        }
+        else if (argv[i][0] != '-' && !spec_path)
+        {
+            spec_path = argv[i];
+        }
+        else
+        {
+            spec_path = nullptr;
+            break;
+        }
+    }
+    if (!spec_path)
+    {
+        std::fprintf(stderr, "usage: %s <grid file> [--jobs=N] [--dry-run]\n", argv[0]);
+        return 1;
+    }
+
+    SweepSpec spec;
+    if (!ReadSpec(spec_path, spec))
+    {
+        return 1;
+    }
+    if (jobs_override > 0)
+    {
+        spec.jobs = jobs_override;
+    }
+    if (spec.jobs <= 0)
+    {
+        spec.jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<Job> jobs = ExpandGrid(spec);
+    if (dry_run)
+    {
+        for (const Job& job : jobs)
+        {
+            std::printf("%s\n", JoinCommand(BuildCommand(spec, job)).c_str());
+        }
+        return 0;
+    }
+
+    if (mkdir(spec.workdir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        std::perror(spec.workdir.c_str());
+        return 1;
+    }
+
+    std::printf("%zu runs, %d at a time\n", jobs.size(), spec.jobs);
+
+    // Runs are independent processes, so the only scheduling is keeping jobs of them busy
+    std::map<pid_t, size_t> running;
+    std::vector<Clock::time_point> started(jobs.size());
+    std::vector<bool> succeeded(jobs.size(), false);
+    size_t next = 0;
+    size_t finished = 0;
+    int failures = 0;
+
+    while (finished < jobs.size())
+    {
+        while (next < jobs.size() && static_cast<int>(running.size()) < spec.jobs)
+        {
+            pid_t pid = Launch(BuildCommand(spec, jobs[next]), jobs[next].log_path);
+            if (pid < 0)
+            {
+                std::perror("fork");
+                break;
+            }
+            started[next] = Clock::now();
+            running[pid] = next++;
+        }
+        if (running.empty())
+        {
+            // Could not fork anything: count what's left as failed
+            failures += static_cast<int>(jobs.size() - next);
+            break;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::perror("waitpid");
+            return 1;
+        }
+        auto it = running.find(pid);
+        if (it == running.end())
+        {
+            continue;
+        }
+
+        size_t index = it->second;
+        running.erase(it);
+        finished++;
+        const Job& job = jobs[index];
+        double seconds = std::chrono::duration<double>(Clock::now() - started[index]).count();
+        succeeded[index] = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!succeeded[index])
+        {
+            failures++;
+        }
+        std::printf("[%zu/%zu] point %d run %d %s in %.1fs%s%s\n",
+                    finished,
+                    jobs.size(),
+                    job.point,
+                    job.run,
+                    succeeded[index] ? "done" : "FAILED",
+                    seconds,
+                    succeeded[index] ? "" : ", see ",
+                    succeeded[index] ? "" : job.log_path.c_str());
+        std::fflush(stdout);
+    }
+
+    // Merged in grid order, whatever order the runs finished in
+    std::ofstream out(spec.output);
+    std::string header;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (succeeded[i] && !MergeStats(spec, jobs[i], out, header))
+        {
+            std::fprintf(stderr, "bad or missing stats in %s\n", jobs[i].stats_path.c_str());
+            failures++;
+        }
+    }
+    out.flush();
+    if (!out)
+    {
+        std::perror(spec.output.c_str());
+        return 1;
+    }
+
+    std::printf("merged into %s, %d failed\n", spec.output.c_str(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include "timer_wheel.h"
+
+TimerWheel::TimerWheel()
+    : m_now(0)
+{
+}
+
+void
+TimerWheel::Schedule(int key, uint64_t tick)
+{
+    // A deadline already passed fires on the next tick
+    if (tick <= m_now)
+    {
+        tick = m_now + 1;
+    }
+
+    m_deadlines[key] = tick;
+    Place(Entry{key, tick});
+}
+
+void
+TimerWheel::Cancel(int key)
+{
+    m_deadlines.erase(key);
+}
+
+void
+TimerWheel::Place(const Entry& entry)
+{
+    uint64_t delta = entry.tick - m_now;
+    for (int level = 0; level < LEVELS; level++)
+    {
+        if (delta < (uint64_t(1) << (SLOT_BITS * (level + 1))) || level == LEVELS - 1)
+        {
+            // Deadlines past the last level wait in its farthest slot and are placed
+            // again when it cascades
+            uint64_t tick = level == LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * LEVELS))
+                                ? m_now + (uint64_t(SLOTS - 1) << (SLOT_BITS * level))
+                                : entry.tick;
+            m_slots[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(entry);
+            return;
+        }
+    }
+}
+
+void
+TimerWheel::Cascade(int level)
+{
+    std::vector<Entry>& slot = m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    std::vector<Entry> entries;
+    entries.swap(slot);
+
+    for (const Entry& entry : entries)
+    {
+        auto it = m_deadlines.find(entry.key);
+        if (it != m_deadlines.end() && it->second == entry.tick)
+        {
+            Place(entry);
+        }
+    }
+}
+
+void
+TimerWheel::Advance(uint64_t tick, std::vector<int>& expired)
+{
+    while (m_now < tick)
+    {
+        // Nothing left to expire, skip the remaining ticks
+        if (m_deadlines.empty())
+        {
+            Restart(tick);
+            return;
+        }
+
+        m_now++;
+
+        // Each time a level completes a turn, the next slot of the level above is
+        // spread over the levels below
+        for (int level = 1; level < LEVELS; level++)
+        {
+            if ((m_now & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0)
+            {
+                break;
+            }
+            Cascade(level);
+        }
+
+        std::vector<Entry>& slot = m_slots[0][m_now & (SLOTS - 1)];
+        for (const Entry& entry : slot)
+        {
+            auto it = m_deadlines.find(entry.key);
+            if (it != m_deadlines.end() && it->second == entry.tick)
+            {
+                m_deadlines.erase(it);
+                expired.push_back(entry.key);
+            }
+        }
+        slot.clear();
+    }
+}
+
+void
+TimerWheel::Restart(uint64_t tick)
+{
+    for (auto& level : m_slots)
+    {
+        for (std::vector<Entry>& slot : level)
+        {
+            slot.clear();
+        }
+    }
+    m_deadlines.clear();
+    m_now = tick;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Hierarchical timer wheel over int keys, advanced by whole ticks. Each level has 64
+// slots, every slot of a level spanning a full turn of the level below, so four levels
+// cover 2^24 ticks. Scheduling and cancelling are O(1); an entry is moved down a level
+// at most three times before it expires. Cancelled entries stay in their slot and are
+// dropped when it is reached.
+class TimerWheel
+{
+  public:
+    TimerWheel();
+
+    // Arms key to expire at tick, replacing its previous deadline if any
+    void Schedule(int key, uint64_t tick);
+    void Cancel(int key);
+
+    bool IsScheduled(int key) const
+    {
+        return m_deadlines.find(key) != m_deadlines.end();
+    }
+
+    // Moves the wheel to tick, appending the keys that expired on the way to expired
+    void Advance(uint64_t tick, std::vector<int>& expired);
+
+    // Empties the wheel and sets its current tick, e.g. after it sat idle
+    void Restart(uint64_t tick);
+
+    size_t GetSize() const
+    {
+        return m_deadlines.size();
+    }
+
+    uint64_t GetCurrentTick() const
+    {
+        return m_now;
+    }
+
+  private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    struct Entry
+    {
+        int key;
+        uint64_t tick;
+    };
+
+    void Place(const Entry& entry);
+    void Cascade(int level);
+
+    std::vector<Entry> m_slots[LEVELS][SLOTS];
+    std::unordered_map<int, uint64_t> m_deadlines;
+    uint64_t m_now;
+};
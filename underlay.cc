@@ -0,0 +1,290 @@
+#include "underlay.h"
+
+#include "ns3/abort.h"
+#include "ns3/internet-stack-helper.h"
+#include "ns3/ipv4-address-helper.h"
+#include "ns3/ipv4-static-routing-helper.h"
+#include "ns3/ipv4-static-routing.h"
+#include "ns3/ipv4.h"
+#include "ns3/point-to-point-helper.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+namespace ns3
+{
+
+namespace
+{
+// Hubs are linked over 192.168.0.0/16 and gateways to hubs over 172.16.0.0/12
+const char* BACKBONE_BASE = "192.168.0.0";
+const char* UPLINK_BASE = "172.16.0.0";
+const char* LINK_MASK = "255.255.255.252";
+const char* REGION_MASK = "255.224.0.0";
+const char* GATEWAY_MASK = "255.255.255.0";
+const uint32_t GATEWAYS_PER_REGION = 1 << 13;
+
+Ipv4Address
+RegionPrefix(int region)
+{
+    return Ipv4Address((10u << 24) | (static_cast<uint32_t>(region) << 21));
+}
+
+Ipv4Address
+GatewayPrefix(int region, uint32_t gateway)
+{
+    return Ipv4Address(RegionPrefix(region).Get() | (gateway << 8));
+}
+
+Ptr<Ipv4StaticRouting>
+GetStaticRouting(Ptr<Node> node)
+{
+    Ipv4StaticRoutingHelper helper;
+    return helper.GetStaticRouting(node->GetObject<Ipv4>());
+}
+} // namespace
+
+RegionUnderlayConfig
+GetDefaultRegionConfig()
+{
+    RegionUnderlayConfig config;
+    // NORTH_AMERICA, EUROPE, SOUTH_AMERICA, ASIA_PACIFIC, JAPAN, AUSTRALIA, OTHER
+    config.latency_ms = {{36, 119, 255, 310, 154, 208, 150},
+                         {119, 12, 221, 242, 266, 350, 150},
+                         {255, 221, 137, 347, 256, 318, 150},
+                         {310, 242, 347, 99, 172, 260, 150},
+                         {154, 266, 256, 172, 9, 113, 150},
+                         {208, 350, 318, 260, 113, 33, 150},
+                         {150, 150, 150, 150, 150, 150, 50}};
+    config.bandwidth_mbps.assign(REGION_COUNT, std::vector<double>(REGION_COUNT, 1000));
+    config.node_shares = {0.3316, 0.4998, 0.0090, 0.1177, 0.0224, 0.0195, 0};
+    config.gateway_delay = MilliSeconds(1);
+    config.gateway_rate = DataRate("10Gbps");
+    config.access_rate = DataRate("100Mbps");
+    return config;
+}
+
+bool
+LoadRegionMatrices(const std::string& path, RegionUnderlayConfig& config)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    std::vector<double> values;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (!line.empty() && line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream numbers(line);
+        double value;
+        while (numbers >> value)
+        {
+            values.push_back(value);
+        }
+    }
+
+    if (values.size() != 2 * REGION_COUNT * REGION_COUNT)
+    {
+        return false;
+    }
+
+    for (int r = 0; r < REGION_COUNT; r++)
+    {
+        for (int s = 0; s < REGION_COUNT; s++)
+        {
+            config.latency_ms[r][s] = values[r * REGION_COUNT + s];
+            config.bandwidth_mbps[r][s] = values[(REGION_COUNT + r) * REGION_COUNT + s];
+        }
+    }
+    return true;
+}
+
+Region
+PickRegion(const RegionUnderlayConfig& config, double uniform)
+{
+    double total = 0;
+    for (double share : config.node_shares)
+    {
+        total += share;
+    }
+
+    double target = uniform * total;
+    for (int r = 0; r < REGION_COUNT; r++)
+    {
+        target -= config.node_shares[r];
+        if (target < 0)
+        {
+            return static_cast<Region>(r);
+        }
+    }
+    return NORTH_AMERICA;
+}
+
+std::vector<uint32_t>
+PartitionRegions(const std::vector<Region>& regions, uint32_t system_count)
+{
+    std::vector<size_t> sizes(REGION_COUNT, 0);
+    for (Region region : regions)
+    {
+        sizes[region]++;
+    }
+
+    // Largest region first onto the least loaded process
+    std::vector<int> order(REGION_COUNT);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&sizes](int a, int b) {
+        return sizes[a] > sizes[b];
+    });
+
+    std::vector<size_t> loads(system_count, 0);
+    std::vector<uint32_t> owners(REGION_COUNT, 0);
+    for (int r : order)
+    {
+        uint32_t owner =
+            static_cast<uint32_t>(std::min_element(loads.begin(), loads.end()) - loads.begin());
+        owners[r] = owner;
+        loads[owner] += sizes[r];
+    }
+    return owners;
+}
+
+RegionUnderlay::RegionUnderlay(const RegionUnderlayConfig& config)
+    : m_config(config)
+{
+}
+
+Time
+RegionUnderlay::GetAccessDelay(int region) const
+{
+    // Node to gateway to hub makes up half the latency within the region
+    Time delay = Seconds(m_config.latency_ms[region][region] / 2000) - m_config.gateway_delay;
+    return std::max(delay, MicroSeconds(100));
+}
+
+Time
+RegionUnderlay::GetBackboneDelay(int from, int to) const
+{
+    double delay = m_config.latency_ms[from][to] - m_config.latency_ms[from][from] / 2 -
+                   m_config.latency_ms[to][to] / 2;
+    return Seconds(std::max(delay, 1.0) / 1000);
+}
+
+void
+RegionUnderlay::Install(const NodeContainer& nodes,
+                        const std::vector<Region>& regions,
+                        const std::vector<double>& access_mbps)
+{
+    std::vector<std::vector<uint32_t>> members(REGION_COUNT);
+    for (uint32_t i = 0; i < nodes.GetN(); i++)
+    {
+        members[regions[i]].push_back(i);
+    }
+    m_addresses.assign(nodes.GetN(), Ipv4Address());
+
+    InternetStackHelper internet;
+    PointToPointHelper p2p;
+
+    for (int r = 0; r < REGION_COUNT; r++)
+    {
+        uint32_t system_id = members[r].empty() ? 0 : nodes.Get(members[r][0])->GetSystemId();
+        for (uint32_t index : members[r])
+        {
+            NS_ABORT_MSG_IF(nodes.Get(index)->GetSystemId() != system_id,
+                            "Nodes of region " << r << " belong to different processes");
+        }
+
+        Ptr<Node> hub = CreateObject<Node>(system_id);
+        internet.Install(hub);
+        m_hubs.Add(hub);
+    }
+
+    // Backbone: each hub reaches the other regions' prefixes over its direct link
+    Ipv4AddressHelper backbone;
+    backbone.SetBase(BACKBONE_BASE, LINK_MASK);
+    for (int r = 0; r < REGION_COUNT; r++)
+    {
+        for (int s = r + 1; s < REGION_COUNT; s++)
+        {
+            uint64_t rate = static_cast<uint64_t>(m_config.bandwidth_mbps[r][s] * 1e6);
+            p2p.SetDeviceAttribute("DataRate", DataRateValue(DataRate(rate)));
+            p2p.SetChannelAttribute("Delay", TimeValue(GetBackboneDelay(r, s)));
+            NetDeviceContainer devs = p2p.Install(m_hubs.Get(r), m_hubs.Get(s));
+            Ipv4InterfaceContainer ifs = backbone.Assign(devs);
+            backbone.NewNetwork();
+
+            GetStaticRouting(m_hubs.Get(r))
+                ->AddNetworkRouteTo(RegionPrefix(s),
+                                    Ipv4Mask(REGION_MASK),
+                                    ifs.GetAddress(1),
+                                    ifs.Get(0).second);
+            GetStaticRouting(m_hubs.Get(s))
+                ->AddNetworkRouteTo(RegionPrefix(r),
+                                    Ipv4Mask(REGION_MASK),
+                                    ifs.GetAddress(0),
+                                    ifs.Get(1).second);
+        }
+    }
+
+    Ipv4AddressHelper uplinks;
+    uplinks.SetBase(UPLINK_BASE, LINK_MASK);
+    for (int r = 0; r < REGION_COUNT; r++)
+    {
+        uint32_t gateway_count = (members[r].size() + NODES_PER_GATEWAY - 1) / NODES_PER_GATEWAY;
+        NS_ABORT_MSG_IF(gateway_count > GATEWAYS_PER_REGION,
+                        "Too many nodes in region " << r << " for its address space");
+
+        for (uint32_t g = 0; g < gateway_count; g++)
+        {
+            size_t first = g * NODES_PER_GATEWAY;
+            size_t last = std::min(first + NODES_PER_GATEWAY, members[r].size());
+
+            Ptr<Node> gateway = CreateObject<Node>(m_hubs.Get(r)->GetSystemId());
+            internet.Install(gateway);
+            m_gateways.Add(gateway);
+
+            p2p.SetDeviceAttribute("DataRate", DataRateValue(m_config.gateway_rate));
+            p2p.SetChannelAttribute("Delay", TimeValue(m_config.gateway_delay));
+            NetDeviceContainer devs = p2p.Install(gateway, m_hubs.Get(r));
+            Ipv4InterfaceContainer ifs = uplinks.Assign(devs);
+            uplinks.NewNetwork();
+
+            GetStaticRouting(gateway)->SetDefaultRoute(ifs.GetAddress(1), ifs.Get(0).second);
+            GetStaticRouting(m_hubs.Get(r))
+                ->AddNetworkRouteTo(GatewayPrefix(r, g),
+                                    Ipv4Mask(GATEWAY_MASK),
+                                    ifs.GetAddress(0),
+                                    ifs.Get(1).second);
+
+            Ipv4AddressHelper access;
+            access.SetBase(GatewayPrefix(r, g), LINK_MASK);
+            p2p.SetChannelAttribute("Delay", TimeValue(GetAccessDelay(r)));
+            for (size_t k = first; k < last; k++)
+            {
+                uint32_t index = members[r][k];
+                DataRate rate =
+                    access_mbps.empty()
+                        ? m_config.access_rate
+                        : DataRate(static_cast<uint64_t>(access_mbps[index] * 1e6));
+                p2p.SetDeviceAttribute("DataRate", DataRateValue(rate));
+
+                NetDeviceContainer access_devs = p2p.Install(nodes.Get(index), gateway);
+                Ipv4InterfaceContainer access_ifs = access.Assign(access_devs);
+                access.NewNetwork();
+
+                GetStaticRouting(nodes.Get(index))
+                    ->SetDefaultRoute(access_ifs.GetAddress(1), access_ifs.Get(0).second);
+                m_addresses[index] = access_ifs.GetAddress(0);
+            }
+        }
+    }
+}
+
+} // namespace ns3
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "dag.h"
+
+#include "ns3/data-rate.h"
+#include "ns3/ipv4-address.h"
+#include "ns3/node-container.h"
+#include "ns3/nstime.h"
+
+#include <string>
+#include <vector>
+
+namespace ns3
+{
+const int REGION_COUNT = OTHER + 1;
+
+// Latencies are one-way, end to end between two nodes of the given regions
+struct RegionUnderlayConfig
+{
+    std::vector<std::vector<double>> latency_ms;
+    std::vector<std::vector<double>> bandwidth_mbps; // of the backbone link between regions
+    std::vector<double> node_shares;                 // fraction of the nodes in each region
+    Time gateway_delay;
+    DataRate gateway_rate;
+    DataRate access_rate;
+};
+
+// Bitcoin node latencies and distribution measured for SimBlock (2019), with OTHER
+// getting no nodes by default
+RegionUnderlayConfig GetDefaultRegionConfig();
+
+// Reads REGION_COUNT x REGION_COUNT latencies in ms, then as many bandwidths in Mbps, as
+// whitespace separated numbers. Lines starting with # are skipped.
+bool LoadRegionMatrices(const std::string& path, RegionUnderlayConfig& config);
+
+// Picks a region by node share for a uniform value in [0, 1)
+Region PickRegion(const RegionUnderlayConfig& config, double uniform);
+
+// Assigns each region to one of system_count processes, balancing their node counts.
+// With more processes than populated regions, the extra ones get no nodes.
+std::vector<uint32_t> PartitionRegions(const std::vector<Region>& regions,
+                                       uint32_t system_count);
+
+// Routed underlay that grows linearly with the nodes. Each region has a hub, the hubs
+// are fully meshed with the configured backbone links, and every node hangs off a
+// gateway of its region that serves up to NODES_PER_GATEWAY nodes. Region r owns
+// 10.(r << 5).0.0/11 and each gateway a /24 of it, one /30 per node, so routing is
+// static: nodes and gateways default up, hubs route per gateway and per region.
+// Access delays are set so two nodes of regions r and s are latency_ms[r][s] apart,
+// except two nodes behind the same gateway: their traffic turns at the gateway, short
+// of the hub, so they are latency_ms[r][r] - 2 * gateway_delay apart.
+class RegionUnderlay
+{
+  public:
+    static const uint32_t NODES_PER_GATEWAY = 64;
+    static const uint32_t GATEWAY_PREFIX_LENGTH = 24; // nodes behind one gateway share it
+
+    explicit RegionUnderlay(const RegionUnderlayConfig& config);
+
+    // Builds the routers and links. The nodes need an internet stack already;
+    // access_mbps, if not empty, sets each node's access link instead of access_rate.
+    // All nodes of a region must belong to one MPI process, e.g. by PartitionRegions,
+    // and its hub and gateways go there too. Only backbone links then cross processes,
+    // so the lookahead is the smallest backbone delay between regions of different
+    // processes: latency_ms[r][s] less half of each region's own latency, at least 1 ms
+    // (92 ms between JAPAN and AUSTRALIA with the defaults).
+    void Install(const NodeContainer& nodes,
+                 const std::vector<Region>& regions,
+                 const std::vector<double>& access_mbps = std::vector<double>());
+
+    Ipv4Address GetAddress(uint32_t node_index) const
+    {
+        return m_addresses[node_index];
+    }
+
+  private:
+    Time GetAccessDelay(int region) const;
+    Time GetBackboneDelay(int from, int to) const;
+
+    RegionUnderlayConfig m_config;
+    NodeContainer m_hubs;
+    NodeContainer m_gateways;
+    std::vector<Ipv4Address> m_addresses;
+};
+
+} // namespace ns3
@@ -0,0 +1,777 @@
+#include "wire_codec.h"
+
+#include <cstring>
+
+namespace ns3
+{
+
+NS_OBJECT_ENSURE_REGISTERED(GhostDagFrame);
+
+namespace
+{
+const uint32_t HASH_SIZE = 32;
+const uint32_t ADDRESS_ENTRY_SIZE = 30; // time, services, IPv6-mapped address and port
+const uint32_t SHORT_TX_ID_SIZE = 6;    // BIP152 SipHash short ids
+const uint32_t TX_INDEX_SIZE = 1;       // differentially encoded indexes are mostly 1 byte
+const uint32_t RECON_SHORT_ID_SIZE = 4; // Erlay 32-bit short ids
+const uint32_t SKETCH_CELL_SIZE = 9;    // count byte, id xor and checksum xor
+
+// Counts the bytes an encoding takes without writing it
+class SizeWriter
+{
+  public:
+    SizeWriter()
+        : size(0)
+    {
+    }
+
+    void WriteU8(uint8_t)
+    {
+        size++;
+    }
+
+    void WriteU32(uint32_t)
+    {
+        size += 4;
+    }
+
+    void WriteU64(uint64_t)
+    {
+        size += 8;
+    }
+
+    uint32_t size;
+};
+
+class BufferWriter
+{
+  public:
+    explicit BufferWriter(Buffer::Iterator& it)
+        : m_it(it)
+    {
+    }
+
+    void WriteU8(uint8_t value)
+    {
+        m_it.WriteU8(value);
+    }
+
+    void WriteU32(uint32_t value)
+    {
+        m_it.WriteHtonU32(value);
+    }
+
+    void WriteU64(uint64_t value)
+    {
+        m_it.WriteHtonU64(value);
+    }
+
+  private:
+    Buffer::Iterator& m_it;
+};
+
+// Same interface as WireReader over a packet buffer iterator
+class BufferReader
+{
+  public:
+    BufferReader(Buffer::Iterator& it, uint32_t size)
+        : m_it(it),
+          m_remaining(size),
+          m_ok(true)
+    {
+    }
+
+    uint8_t ReadU8()
+    {
+        if (!Take(1))
+        {
+            return 0;
+        }
+        return m_it.ReadU8();
+    }
+
+    uint32_t ReadU32()
+    {
+        if (!Take(4))
+        {
+            return 0;
+        }
+        return m_it.ReadNtohU32();
+    }
+
+    uint64_t ReadU64()
+    {
+        if (!Take(8))
+        {
+            return 0;
+        }
+        return m_it.ReadNtohU64();
+    }
+
+    uint64_t ReadVarInt();
+    int64_t ReadSignedVarInt();
+    double ReadDouble();
+
+    bool Ok() const
+    {
+        return m_ok;
+    }
+
+    void Fail()
+    {
+        m_ok = false;
+    }
+
+    uint32_t GetRemaining() const
+    {
+        return m_remaining;
+    }
+
+  private:
+    bool Take(uint32_t bytes)
+    {
+        if (!m_ok || m_remaining < bytes)
+        {
+            m_ok = false;
+            return false;
+        }
+        m_remaining -= bytes;
+        return true;
+    }
+
+    Buffer::Iterator& m_it;
+    uint32_t m_remaining;
+    bool m_ok;
+};
+
+template <typename Reader>
+uint64_t
+ReadVarIntFrom(Reader& reader)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        uint8_t byte = reader.ReadU8();
+        if (!reader.Ok())
+        {
+            return 0;
+        }
+        // The tenth byte only has room for bit 63
+        if (shift == 63 && (byte & 0x7e))
+        {
+            break;
+        }
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return value;
+        }
+    }
+    reader.Fail();
+    return 0;
+}
+
+int64_t
+ZigzagDecode(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+uint64_t
+ZigzagEncode(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+double
+DoubleFromBits(uint64_t bits)
+{
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint64_t
+DoubleToBits(double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+uint32_t
+VarIntSize(uint64_t value)
+{
+    uint32_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+template <typename Writer>
+void
+WriteVarInt(Writer& writer, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        writer.WriteU8(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    writer.WriteU8(static_cast<uint8_t>(value));
+}
+
+template <typename Writer>
+void
+WriteSignedVarInt(Writer& writer, int64_t value)
+{
+    WriteVarInt(writer, ZigzagEncode(value));
+}
+
+template <typename Writer>
+void
+WriteIds(Writer& writer, const std::vector<int>& ids)
+{
+    WriteVarInt(writer, ids.size());
+    for (int id : ids)
+    {
+        WriteSignedVarInt(writer, id);
+    }
+}
+
+template <typename Writer>
+void
+WriteHeader(Writer& writer, const BlockHeader& header)
+{
+    WriteSignedVarInt(writer, header.block_id);
+    WriteSignedVarInt(writer, header.miner_id);
+    writer.WriteU64(DoubleToBits(header.time_created));
+    WriteIds(writer, header.parent_hashes);
+}
+
+template <typename Writer>
+void
+WriteTransaction(Writer& writer, const Transaction& tx)
+{
+    WriteSignedVarInt(writer, tx.tx_id);
+    WriteVarInt(writer, static_cast<uint32_t>(tx.size_bytes));
+}
+
+template <typename Writer>
+void
+WriteTransactions(Writer& writer, const std::set<Transaction>& transactions)
+{
+    WriteVarInt(writer, transactions.size());
+    for (const Transaction& tx : transactions)
+    {
+        WriteTransaction(writer, tx);
+    }
+}
+
+template <typename Writer>
+void
+WritePayload(Writer& writer, const GhostDagMessage& message)
+{
+    switch (message.type)
+    {
+    case PING:
+    case REQ_ADDRESSES:
+        break;
+
+    case ADDRESSES:
+        WriteVarInt(writer, message.addresses.size());
+        for (const Ipv4Address& address : message.addresses)
+        {
+            writer.WriteU32(address.Get());
+        }
+        break;
+
+    case BLOCK_HEADERS:
+        WriteVarInt(writer, message.headers.size());
+        for (const BlockHeader& header : message.headers)
+        {
+            WriteHeader(writer, header);
+        }
+        break;
+
+    case BLOCK_BODY:
+    case BLOCK_TRANSACTIONS:
+        WriteSignedVarInt(writer, message.block.header.block_id);
+        WriteTransactions(writer, message.block.transactions);
+        break;
+
+    case BLOCK:
+    case IDB_BLOCK:
+        WriteHeader(writer, message.block.header);
+        WriteVarInt(writer, static_cast<uint32_t>(message.block.size_in_bytes));
+        WriteTransactions(writer, message.block.transactions);
+        break;
+
+    case COMPACT_BLOCK:
+        WriteHeader(writer, message.block.header);
+        WriteVarInt(writer, static_cast<uint32_t>(message.block.size_in_bytes));
+        WriteIds(writer, message.ids);
+        break;
+
+    case TRANSACTION:
+        WriteVarInt(writer, message.transactions.size());
+        for (const Transaction& tx : message.transactions)
+        {
+            WriteTransaction(writer, tx);
+        }
+        break;
+
+    case RECONCILIATION_SKETCH:
+        WriteVarInt(writer, message.sketch.cells.size());
+        for (const SetSketch::Cell& cell : message.sketch.cells)
+        {
+            WriteSignedVarInt(writer, cell.count);
+            writer.WriteU32(cell.id_sum);
+            writer.WriteU32(cell.hash_sum);
+        }
+        break;
+
+    default:
+        WriteIds(writer, message.ids);
+        break;
+    }
+}
+
+template <typename Reader>
+void
+ReadIds(Reader& reader, std::vector<int>& ids)
+{
+    uint64_t count = reader.ReadVarInt();
+    // Every id takes at least a byte, which bounds counts from corrupt frames
+    if (count > reader.GetRemaining())
+    {
+        reader.Fail();
+        return;
+    }
+    ids.resize(count);
+    for (int& id : ids)
+    {
+        id = static_cast<int>(reader.ReadSignedVarInt());
+    }
+}
+
+template <typename Reader>
+void
+ReadHeader(Reader& reader, BlockHeader& header)
+{
+    header.block_id = static_cast<int>(reader.ReadSignedVarInt());
+    header.miner_id = static_cast<int>(reader.ReadSignedVarInt());
+    header.time_created = reader.ReadDouble();
+    ReadIds(reader, header.parent_hashes);
+}
+
+template <typename Reader>
+Transaction
+ReadTransaction(Reader& reader)
+{
+    Transaction tx;
+    tx.tx_id = static_cast<int>(reader.ReadSignedVarInt());
+    tx.size_bytes = static_cast<int>(reader.ReadVarInt());
+    tx.arrival_time = 0;
+    return tx;
+}
+
+template <typename Reader>
+void
+ReadTransactions(Reader& reader, std::set<Transaction>& transactions)
+{
+    uint64_t count = reader.ReadVarInt();
+    for (uint64_t i = 0; i < count && reader.Ok(); i++)
+    {
+        transactions.insert(transactions.end(), ReadTransaction(reader));
+    }
+}
+
+template <typename Reader>
+bool
+ReadPayload(Reader& reader, GhostDagMessage& message)
+{
+    switch (message.type)
+    {
+    case PING:
+    case REQ_ADDRESSES:
+        break;
+
+    case ADDRESSES: {
+        uint64_t count = reader.ReadVarInt();
+        if (count > MAX_ADDRESSES_PER_MESSAGE)
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < count && reader.Ok(); i++)
+        {
+            message.addresses.emplace_back(reader.ReadU32());
+        }
+        break;
+    }
+
+    case BLOCK_HEADERS: {
+        uint64_t count = reader.ReadVarInt();
+        for (uint64_t i = 0; i < count && reader.Ok(); i++)
+        {
+            message.headers.emplace_back();
+            ReadHeader(reader, message.headers.back());
+        }
+        break;
+    }
+
+    case BLOCK_BODY:
+    case BLOCK_TRANSACTIONS:
+        message.block.header.block_id = static_cast<int>(reader.ReadSignedVarInt());
+        ReadTransactions(reader, message.block.transactions);
+        break;
+
+    case BLOCK:
+    case IDB_BLOCK:
+        ReadHeader(reader, message.block.header);
+        message.block.size_in_bytes = static_cast<int>(reader.ReadVarInt());
+        ReadTransactions(reader, message.block.transactions);
+        break;
+
+    case COMPACT_BLOCK:
+        ReadHeader(reader, message.block.header);
+        message.block.size_in_bytes = static_cast<int>(reader.ReadVarInt());
+        ReadIds(reader, message.ids);
+        break;
+
+    case TRANSACTION: {
+        uint64_t count = reader.ReadVarInt();
+        for (uint64_t i = 0; i < count && reader.Ok(); i++)
+        {
+            message.transactions.push_back(ReadTransaction(reader));
+        }
+        break;
+    }
+
+    case RECONCILIATION_SKETCH: {
+        uint64_t count = reader.ReadVarInt();
+        // Sketches split their cells evenly between the hashes. A cell takes at least 9
+        // bytes, which bounds counts from corrupt frames.
+        if (count == 0 || count % SetSketch::HASH_COUNT != 0 || count > reader.GetRemaining() / 9)
+        {
+            reader.Fail();
+            break;
+        }
+        message.sketch.cells.resize(count);
+        for (SetSketch::Cell& cell : message.sketch.cells)
+        {
+            cell.count = static_cast<int32_t>(reader.ReadSignedVarInt());
+            cell.id_sum = reader.ReadU32();
+            cell.hash_sum = reader.ReadU32();
+        }
+        break;
+    }
+
+    default:
+        if (message.type > RECONCILIATION_DIFF)
+        {
+            return false;
+        }
+        ReadIds(reader, message.ids);
+        break;
+    }
+
+    return reader.Ok();
+}
+
+uint32_t
+GetPayloadSize(const GhostDagMessage& message)
+{
+    SizeWriter sizer;
+    WritePayload(sizer, message);
+    return sizer.size;
+}
+
+uint32_t
+GetTransactionsModeledSize(const std::set<Transaction>& transactions)
+{
+    uint32_t size = VarIntSize(transactions.size());
+    for (const Transaction& tx : transactions)
+    {
+        size += tx.size_bytes;
+    }
+    return size;
+}
+} // namespace
+
+uint64_t
+BufferReader::ReadVarInt()
+{
+    return ReadVarIntFrom(*this);
+}
+
+int64_t
+BufferReader::ReadSignedVarInt()
+{
+    return ZigzagDecode(ReadVarInt());
+}
+
+double
+BufferReader::ReadDouble()
+{
+    return DoubleFromBits(ReadU64());
+}
+
+void
+GhostDagMessage::Clear()
+{
+    ids.clear();
+    addresses.clear();
+    headers.clear();
+    transactions.clear();
+    block.header.parent_hashes.clear();
+    block.transactions.clear();
+    block.size_in_bytes = 0;
+    sketch.cells.clear();
+}
+
+uint8_t
+WireReader::ReadU8()
+{
+    if (!m_ok || m_offset + 1 > m_size)
+    {
+        m_ok = false;
+        return 0;
+    }
+    return m_data[m_offset++];
+}
+
+uint32_t
+WireReader::ReadU32()
+{
+    if (!m_ok || m_offset + 4 > m_size)
+    {
+        m_ok = false;
+        return 0;
+    }
+    const uint8_t* p = m_data + m_offset;
+    m_offset += 4;
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+uint64_t
+WireReader::ReadU64()
+{
+    uint64_t high = ReadU32();
+    return (high << 32) | ReadU32();
+}
+
+uint64_t
+WireReader::ReadVarInt()
+{
+    return ReadVarIntFrom(*this);
+}
+
+int64_t
+WireReader::ReadSignedVarInt()
+{
+    return ZigzagDecode(ReadVarInt());
+}
+
+double
+WireReader::ReadDouble()
+{
+    return DoubleFromBits(ReadU64());
+}
+
+GhostDagFrame::GhostDagFrame()
+    : m_message(nullptr),
+      m_payload_size(0),
+      m_padding(0)
+{
+}
+
+GhostDagFrame::GhostDagFrame(const GhostDagMessage& message, uint32_t padding)
+    : m_message(&message),
+      m_payload_size(GetPayloadSize(message)),
+      m_padding(padding)
+{
+}
+
+TypeId
+GhostDagFrame::GetTypeId()
+{
+    static TypeId tid = TypeId("ns3::GhostDagFrame")
+                            .SetParent<Header>()
+                            .SetGroupName("Applications")
+                            .AddConstructor<GhostDagFrame>();
+    return tid;
+}
+
+TypeId
+GhostDagFrame::GetInstanceTypeId() const
+{
+    return GetTypeId();
+}
+
+uint32_t
+GhostDagFrame::GetSerializedSize() const
+{
+    return FRAME_HEADER_SIZE + m_payload_size;
+}
+
+void
+GhostDagFrame::Serialize(Buffer::Iterator start) const
+{
+    // The padding follows as the packet's zero area, so the length covers it too
+    start.WriteHtonU32(FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE + m_payload_size + m_padding);
+    start.WriteU8(static_cast<uint8_t>(m_message->type));
+    start.WriteHtonU32(m_payload_size);
+    BufferWriter writer(start);
+    WritePayload(writer, *m_message);
+}
+
+uint32_t
+GhostDagFrame::Deserialize(Buffer::Iterator start)
+{
+    uint32_t length = start.ReadNtohU32();
+    m_decoded.Clear();
+    m_decoded.type = static_cast<Messages>(start.ReadU8());
+    m_payload_size = start.ReadNtohU32();
+
+    BufferReader reader(start, m_payload_size);
+    ReadPayload(reader, m_decoded);
+
+    m_message = &m_decoded;
+    uint32_t header_and_payload = FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE + m_payload_size;
+    m_padding = length > header_and_payload ? length - header_and_payload : 0;
+    return FRAME_HEADER_SIZE + m_payload_size;
+}
+
+void
+GhostDagFrame::Print(std::ostream& os) const
+{
+    os << "type=" << (m_message ? static_cast<int>(m_message->type) : -1)
+       << " payload=" << m_payload_size << " padding=" << m_padding;
+}
+
+const GhostDagMessage&
+GhostDagFrame::GetMessage() const
+{
+    return *m_message;
+}
+
+uint32_t
+GetModeledSize(const GhostDagMessage& message)
+{
+    switch (message.type)
+    {
+    case PING:
+        return 8; // nonce
+    case PONG:
+        return 24; // nonce, virtual blue score and upload speed
+    case REQ_ADDRESSES:
+        return 0;
+    case ADDRESSES:
+        return VarIntSize(message.addresses.size()) +
+               ADDRESS_ENTRY_SIZE * static_cast<uint32_t>(message.addresses.size());
+    case BLOCK_HEADERS: {
+        uint32_t size = VarIntSize(message.headers.size());
+        for (const BlockHeader& header : message.headers)
+        {
+            size += header.GetSizeInBytes();
+        }
+        return size;
+    }
+    case BLOCK_BODY:
+    case BLOCK_TRANSACTIONS:
+        return HASH_SIZE + GetTransactionsModeledSize(message.block.transactions);
+    case COMPACT_BLOCK:
+        // Header, nonce for the short ids, then the short ids
+        return message.block.header.GetSizeInBytes() + 8 + VarIntSize(message.ids.size()) +
+               SHORT_TX_ID_SIZE * static_cast<uint32_t>(message.ids.size());
+    case REQ_BLOCK_TRANSACTIONS:
+        return HASH_SIZE + VarIntSize(message.ids.size()) +
+               TX_INDEX_SIZE * static_cast<uint32_t>(message.ids.size());
+    case BLOCK:
+    case IDB_BLOCK:
+        return message.block.header.GetSizeInBytes() +
+               GetTransactionsModeledSize(message.block.transactions);
+    case TRANSACTION: {
+        uint32_t size = VarIntSize(message.transactions.size());
+        for (const Transaction& tx : message.transactions)
+        {
+            size += tx.size_bytes;
+        }
+        return size;
+    }
+    case REQ_RECONCILIATION:
+        return 4; // set size and q coefficient, 16 bits each
+    case RECONCILIATION_SKETCH:
+        return VarIntSize(message.sketch.cells.size()) +
+               SKETCH_CELL_SIZE * static_cast<uint32_t>(message.sketch.cells.size());
+    case RECONCILIATION_DIFF: {
+        // Requested transactions go by short id, announced ones by full hash
+        if (message.ids.size() < 2)
+        {
+            return 1;
+        }
+        uint32_t requested = static_cast<uint32_t>(message.ids[1]);
+        uint32_t announced = static_cast<uint32_t>(message.ids.size()) - 2 - requested;
+        return 1 + VarIntSize(requested) + RECON_SHORT_ID_SIZE * requested +
+               VarIntSize(announced) + HASH_SIZE * announced;
+    }
+    default:
+        return VarIntSize(message.ids.size()) + HASH_SIZE * static_cast<uint32_t>(message.ids.size());
+    }
+}
+
+Ptr<Packet>
+CreateMessagePacket(const GhostDagMessage& message)
+{
+    GhostDagFrame frame(message, 0);
+    uint32_t encoded_size = frame.GetSerializedSize() - FRAME_HEADER_SIZE;
+    uint32_t modeled_size = GetModeledSize(message);
+    uint32_t padding = modeled_size > encoded_size ? modeled_size - encoded_size : 0;
+
+    // A packet created with a size starts as a zero area, which is never allocated
+    Ptr<Packet> packet = Create<Packet>(padding);
+    packet->AddHeader(GhostDagFrame(message, padding));
+    return packet;
+}
+
+bool
+PeekFrame(const uint8_t* data, uint32_t size, FrameInfo& info)
+{
+    if (size < FRAME_HEADER_SIZE)
+    {
+        return false;
+    }
+    WireReader reader(data, FRAME_HEADER_SIZE);
+    info.frame_size = FRAME_LENGTH_SIZE + reader.ReadU32();
+    reader.ReadU8();
+    info.payload_size = reader.ReadU32();
+    return true;
+}
+
+bool
+IsFrameValid(const FrameInfo& info)
+{
+    return info.frame_size >= FRAME_HEADER_SIZE && info.frame_size <= MAX_FRAME_SIZE &&
+           info.payload_size <= info.frame_size - FRAME_HEADER_SIZE;
+}
+
+bool
+DecodeFrame(const uint8_t* data, const FrameInfo& info, GhostDagMessage& message)
+{
+    if (!IsFrameValid(info))
+    {
+        return false;
+    }
+
+    message.Clear();
+    message.type = static_cast<Messages>(data[FRAME_LENGTH_SIZE]);
+
+    // The whole payload has to be used, anything else means a corrupt stream
+    WireReader reader(data + FRAME_HEADER_SIZE, info.payload_size);
+    return ReadPayload(reader, message) && reader.GetRemaining() == 0;
+}
+
+} // namespace ns3
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "dag.h"
+#include "set_sketch.h"
+
+#include "ns3/buffer.h"
+#include "ns3/header.h"
+#include "ns3/ipv4-address.h"
+#include "ns3/packet.h"
+#include "ns3/ptr.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ns3
+{
+// Decoded form of every Messages type; only the fields the type uses are filled:
+//   ids          - block or transaction ids of inventories, requests and locators
+//   addresses    - ADDRESSES
+//   headers      - BLOCK_HEADERS
+//   transactions - TRANSACTION
+//   block        - BLOCK and IDB_BLOCK, the header of COMPACT_BLOCK, and the id plus
+//                  transactions of BLOCK_BODY and BLOCK_TRANSACTIONS
+//   sketch       - RECONCILIATION_SKETCH
+//
+// COMPACT_BLOCK carries the block's transaction ids in ids, REQ_BLOCK_TRANSACTIONS the
+// block id followed by the ids of the transactions the requester is missing.
+// PONG carries the sender's virtual blue score and upload speed in B/s in ids. REQ_HEADERS
+// carries the id of the last header received in this sync, or -1 to start one, followed by
+// the block locator.
+// REQ_BLOCK_LOCATOR carries a block locator, answered by a BLOCK_LOCATOR with the entry
+// above the highest one the sender has, or -1, then that entry. REQ_ANTIPAST carries the
+// highest shared chain block, then the requester's tips.
+// REQ_RECONCILIATION carries the size of the initiator's reconciliation set in ids.
+// RECONCILIATION_DIFF carries a success flag, the number of requested transactions, the
+// requested ids and then the ids announced to the responder.
+struct GhostDagMessage
+{
+    Messages type;
+    std::vector<int> ids;
+    std::vector<Ipv4Address> addresses;
+    std::vector<BlockHeader> headers;
+    std::vector<Transaction> transactions;
+    Block block;
+    SetSketch sketch;
+
+    GhostDagMessage(Messages type = PING)
+        : type(type)
+    {
+    }
+
+    // Keeps vector capacity so a message can be decoded into over and over
+    void Clear();
+};
+
+// Wire frame: a 4-byte big-endian length of everything after it, the message type byte,
+// a 4-byte payload length, the payload, then zero padding up to the size the real
+// protocol message would have. Integers in the payload are LEB128 varints (zigzag for
+// signed ones), times are IEEE doubles. The padding is an ns-3 zero area, so it costs no
+// memory or copies but still takes its share of simulated bandwidth, and a receiver can
+// decode the message as soon as the payload is in and discard the padding unread.
+const uint32_t FRAME_LENGTH_SIZE = 4;
+const uint32_t FRAME_HEADER_SIZE = FRAME_LENGTH_SIZE + 1 + 4;
+const uint32_t MAX_FRAME_SIZE = 32 * 1024 * 1024;
+const size_t MAX_ADDRESSES_PER_MESSAGE = 1000;
+
+struct FrameInfo
+{
+    uint32_t frame_size;   // whole frame, length field and padding included
+    uint32_t payload_size; // encoded payload after the header
+};
+
+// Bounds-checked reader over a contiguous received buffer. A read past the end or a bad
+// varint clears Ok() and returns 0 instead of throwing.
+class WireReader
+{
+  public:
+    WireReader(const uint8_t* data, uint32_t size)
+        : m_data(data),
+          m_size(size),
+          m_offset(0),
+          m_ok(true)
+    {
+    }
+
+    uint8_t ReadU8();
+    uint32_t ReadU32();
+    uint64_t ReadU64();
+    uint64_t ReadVarInt();
+    int64_t ReadSignedVarInt();
+    double ReadDouble();
+
+    bool Ok() const
+    {
+        return m_ok;
+    }
+
+    void Fail()
+    {
+        m_ok = false;
+    }
+
+    uint32_t GetOffset() const
+    {
+        return m_offset;
+    }
+
+    uint32_t GetRemaining() const
+    {
+        return m_size - m_offset;
+    }
+
+  private:
+    const uint8_t* m_data;
+    uint32_t m_size;
+    uint32_t m_offset;
+    bool m_ok;
+};
+
+// Carries one message in a packet. Serialize writes the frame straight into the packet
+// buffer; Deserialize is there for packet printing and traces, the receive path decodes
+// frames from the reassembled stream with DecodeFrame instead.
+class GhostDagFrame : public Header
+{
+  public:
+    GhostDagFrame();
+    GhostDagFrame(const GhostDagMessage& message, uint32_t padding);
+
+    static TypeId GetTypeId();
+    TypeId GetInstanceTypeId() const override;
+    uint32_t GetSerializedSize() const override;
+    void Serialize(Buffer::Iterator start) const override;
+    uint32_t Deserialize(Buffer::Iterator start) override;
+    void Print(std::ostream& os) const override;
+
+    const GhostDagMessage& GetMessage() const;
+
+  private:
+    const GhostDagMessage* m_message;
+    GhostDagMessage m_decoded;
+    uint32_t m_payload_size;
+    uint32_t m_padding;
+};
+
+// Size on the wire of the message in the real protocol: 32-byte hashes, full headers and
+// transaction sizes. Frames are padded up to it.
+uint32_t GetModeledSize(const GhostDagMessage& message);
+
+Ptr<Packet> CreateMessagePacket(const GhostDagMessage& message);
+
+// Reads the header of the frame starting at data; false while fewer than
+// FRAME_HEADER_SIZE bytes are available. A frame above MAX_FRAME_SIZE or a payload
+// longer than its frame means the stream is corrupt, see IsFrameValid.
+bool PeekFrame(const uint8_t* data, uint32_t size, FrameInfo& info);
+bool IsFrameValid(const FrameInfo& info);
+
+// Decodes the frame at data into message. Only the header and the payload have to be
+// there, the padding is never read. False if the payload is malformed.
+bool DecodeFrame(const uint8_t* data, const FrameInfo& info, GhostDagMessage& message);
+
+} // namespace ns3